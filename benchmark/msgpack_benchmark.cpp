@@ -1,6 +1,18 @@
 #include <packer.h>
 #include <unpacker.h>
+#include <stats.h>
 #include <hayai.hpp>
+#include <cinttypes>
+
+// prints the allocation statistics of the benchmark thread, see ENABLE_ALLOC_STATS
+struct alloc_report {
+    ~alloc_report() {
+        if (!msgpack::stats::enabled()) { return; }
+        const msgpack::alloc_stats& s = msgpack::stats::local();
+        printf("allocations: %" PRIu64 ", bytes allocated: %" PRIu64 ", peak buffer size: %" PRIu64 "\n",
+               s.allocations, s.bytes_allocated, s.peak_buffer_size);
+    }
+} report;
 
 class packer_fixture: public ::hayai::Fixture {
 public:
@@ -19,4 +31,45 @@ public:
 
 BENCHMARK_F(packer_fixture, packer, 10, 1000000) {
     run();
-}
\ No newline at end of file
+}
+
+class small_packer_fixture: public ::hayai::Fixture {
+public:
+    void run() {
+        msgpack::small_packer<256> p;
+        p << 1 << 4 << "test";
+        p.map("seq", 1, "ack", true);
+    }
+};
+
+BENCHMARK_F(small_packer_fixture, small_packer, 10, 1000000) {
+    run();
+}
+
+class unpacker_fixture: public ::hayai::Fixture {
+public:
+    virtual void SetUp() {
+        std::vector<int> a(128, 1);
+        msgpack::packer p;
+        p << 1 << 4 << "test" << a;
+        _buffer = p.get_buffer();
+    }
+
+    virtual void TearDown() {
+    }
+
+    void run() {
+        msgpack::unpacker u{ _buffer };
+        int i1, i2;
+        std::string s;
+        std::vector<int> a;
+        u >> i1 >> i2 >> s >> a;
+    }
+
+private:
+    std::vector<uint8_t> _buffer;
+};
+
+BENCHMARK_F(unpacker_fixture, unpacker, 10, 1000000) {
+    run();
+}
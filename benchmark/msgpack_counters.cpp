@@ -0,0 +1,282 @@
+#include <packer.h>
+#include <unpacker.h>
+#include "perf_counters.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//*****************************************************************************
+// Wall time and hardware counters per message and per encoded byte for the
+// pack and unpack paths. Every benchmark is calibrated to run for the given
+// time, the counters cover exactly its measured loop. With --json the results
+// are written as JSON so runs can be diffed; counters the machine does not
+// expose are null.
+//
+//   msgpack_counters [--json] [milliseconds per benchmark]
+//*****************************************************************************
+
+namespace {
+
+struct result {
+    const char* name;
+    size_t bytes;
+    uint64_t messages;
+    double nanoseconds;
+    bool available[perf::C_COUNT];
+    uint64_t counts[perf::C_COUNT];
+};
+
+// keeps the work from being optimized away
+volatile uint64_t checksum;
+
+template<typename F> uint64_t repeat(F& f, const uint64_t n) {
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; ++i) { sum += f(); }
+    return sum;
+}
+
+// f() handles one message of the given size and returns a checksum
+template<typename F> result measure(perf::counters& counters, const char* name, const size_t bytes, F f,
+                                    const int milliseconds) {
+    using clock = std::chrono::steady_clock;
+
+    // doubles the iterations until a run takes a tenth of the target, then scales
+    uint64_t n = 1;
+    for (;;) {
+        const clock::time_point begin = clock::now();
+        checksum += repeat(f, n);
+        const std::chrono::duration<double, std::milli> elapsed = clock::now() - begin;
+        if (elapsed.count() * 10 >= milliseconds) {
+            n = static_cast<uint64_t>(static_cast<double>(n) * milliseconds / elapsed.count()) + 1;
+            break;
+        }
+        n *= 2;
+    }
+
+    counters.start();
+    const clock::time_point begin = clock::now();
+    checksum += repeat(f, n);
+    const std::chrono::duration<double, std::nano> elapsed = clock::now() - begin;
+    counters.stop();
+
+    result r;
+    r.name = name;
+    r.bytes = bytes;
+    r.messages = n;
+    r.nanoseconds = elapsed.count();
+    for (int c = 0; c < perf::C_COUNT; ++c) {
+        r.available[c] = counters.available(static_cast<perf::counter_t>(c));
+        r.counts[c] = counters.value(static_cast<perf::counter_t>(c));
+    }
+    return r;
+}
+
+std::vector<uint8_t> make_batch() {
+    std::vector<msgpack::packer> events(64);
+    for (size_t i = 0; i < events.size(); ++i) {
+        events[i].map("id", static_cast<uint64_t>(i), "name", "event", "values", std::vector<int>(8, static_cast<int>(i)));
+    }
+    msgpack::packer p;
+    p << events;
+    return p.get_buffer();
+}
+
+struct metric {
+    uint64_t timestamp = 0;
+    std::string service_name;
+    std::string endpoint;
+    int64_t latency_us = 0;
+    uint32_t status_code = 0;
+
+    MSGPACK_FIELDS_BEGIN
+        MSGPACK_FIELD(timestamp)
+        MSGPACK_FIELD(service_name)
+        MSGPACK_FIELD(endpoint)
+        MSGPACK_FIELD(latency_us)
+        MSGPACK_FIELD(status_code)
+    MSGPACK_FIELDS_END
+};
+
+// decoded into a pool, so neither variant allocates
+struct pooled_traits : msgpack::default_unpacker_traits {
+    static constexpr bool reuse_capacity = true;
+};
+
+struct pooled_shape_traits : pooled_traits {
+    static constexpr bool cache_shapes = true;
+};
+
+// maps of one layout, as sent by schema-less producers
+std::vector<uint8_t> make_metrics() {
+    msgpack::packer p;
+    p.begin_array();
+    for (uint64_t i = 0; i < 64; ++i) {
+        p.map("timestamp", 1700000000000 + i, "service_name", "checkout", "endpoint", "/api/v1/cart",
+              "latency_us", static_cast<int64_t>(i * 37), "status_code", 200u);
+    }
+    p.end_array();
+    return p.get_buffer();
+}
+
+template<typename Traits> uint64_t decode_metrics(const std::vector<uint8_t>& buffer, std::vector<metric>& pool) {
+    msgpack::basic_unpacker<Traits> u{ msgpack::buffer_view{ buffer.data(), buffer.size() }};
+    u >> pool;
+    return static_cast<uint64_t>(pool.back().latency_us);
+}
+
+std::vector<uint8_t> make_ints() {
+    std::vector<int64_t> v;
+    for (int64_t i = 0; i < 256; ++i) {
+        // every integer width
+        v.push_back((i % 2 == 0 ? 1 : -1) * (int64_t{ 1 } << (i % 63)));
+    }
+    msgpack::packer p;
+    p << v;
+    return p.get_buffer();
+}
+
+void print_table(const std::vector<result>& results) {
+    printf("%-12s %6s %10s %10s %10s %6s %10s %10s %10s %10s\n", "benchmark", "bytes", "ns/msg", "cycles/msg",
+           "instr/msg", "IPC", "brmiss/msg", "l1d/msg", "llc/msg", "cycles/B");
+    for (const result& r : results) {
+        const double m = static_cast<double>(r.messages);
+        printf("%-12s %6zu %10.1f", r.name, r.bytes, r.nanoseconds / m);
+        for (const perf::counter_t c : { perf::C_CYCLES, perf::C_INSTRUCTIONS }) {
+            if (r.available[c]) {
+                printf(" %10.1f", static_cast<double>(r.counts[c]) / m);
+            } else {
+                printf(" %10s", "-");
+            }
+        }
+        if (r.available[perf::C_CYCLES] && r.available[perf::C_INSTRUCTIONS] && r.counts[perf::C_CYCLES] != 0) {
+            printf(" %6.2f", static_cast<double>(r.counts[perf::C_INSTRUCTIONS]) / static_cast<double>(r.counts[perf::C_CYCLES]));
+        } else {
+            printf(" %6s", "-");
+        }
+        for (const perf::counter_t c : { perf::C_BRANCH_MISSES, perf::C_L1D_MISSES, perf::C_LLC_MISSES }) {
+            if (r.available[c]) {
+                printf(" %10.3f", static_cast<double>(r.counts[c]) / m);
+            } else {
+                printf(" %10s", "-");
+            }
+        }
+        if (r.available[perf::C_CYCLES]) {
+            printf(" %10.3f\n", static_cast<double>(r.counts[perf::C_CYCLES]) / (m * static_cast<double>(r.bytes)));
+        } else {
+            printf(" %10s\n", "-");
+        }
+    }
+}
+
+void print_json(const std::vector<result>& results) {
+    printf("{\n  \"benchmarks\": [");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const result& r = results[i];
+        const double m = static_cast<double>(r.messages);
+        const double b = m * static_cast<double>(r.bytes);
+        printf("%s\n    {\"name\": \"%s\", \"messages\": %" PRIu64 ", \"bytes_per_message\": %zu, "
+               "\"ns_per_message\": %.6g, \"ns_per_byte\": %.6g", i == 0 ? "" : ",", r.name, r.messages, r.bytes,
+               r.nanoseconds / m, r.nanoseconds / b);
+        for (int c = 0; c < perf::C_COUNT; ++c) {
+            if (r.available[c]) {
+                printf(", \"%s\": {\"total\": %" PRIu64 ", \"per_message\": %.6g, \"per_byte\": %.6g}",
+                       perf::name(static_cast<perf::counter_t>(c)), r.counts[c], static_cast<double>(r.counts[c]) / m,
+                       static_cast<double>(r.counts[c]) / b);
+            } else {
+                printf(", \"%s\": null", perf::name(static_cast<perf::counter_t>(c)));
+            }
+        }
+        printf("}");
+    }
+    printf("\n  ]\n}\n");
+}
+
+}
+
+int main(int argc, char** argv) {
+    bool json = false;
+    int milliseconds = 200;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else {
+            milliseconds = std::atoi(argv[i]);
+        }
+    }
+
+    perf::counters counters;
+    if (!counters.any_available()) {
+        fprintf(stderr, "no hardware counters, check perf_event_paranoid; reporting wall time only\n");
+    }
+
+    std::vector<result> results;
+
+    // the workloads of msgpack_benchmark, both return the size of their message
+    int a[128] = {};
+    const auto pack = [&a]() -> uint64_t {
+        msgpack::packer p;
+        p << 1 << 4 << "test" << a;
+        return p.buffer().size();
+    };
+    results.push_back(measure(counters, "pack", pack(), pack, milliseconds));
+
+    const auto pack_small = []() -> uint64_t {
+        msgpack::small_packer<256> p;
+        p << 1 << 4 << "test";
+        p.map("seq", 1, "ack", true);
+        return p.view().size;
+    };
+    results.push_back(measure(counters, "pack_small", pack_small(), pack_small, milliseconds));
+
+    msgpack::packer message;
+    message << 1 << 4 << "test" << std::vector<int>(128, 1);
+    const std::vector<uint8_t> unpack_buffer = message.get_buffer();
+    results.push_back(measure(counters, "unpack", unpack_buffer.size(), [&unpack_buffer]() -> uint64_t {
+        msgpack::unpacker u{ unpack_buffer };
+        int i1, i2;
+        std::string s;
+        std::vector<int> v;
+        u >> i1 >> i2 >> s >> v;
+        return static_cast<uint64_t>(i1) + v.size();
+    }, milliseconds));
+
+    // integers of every width read in place
+    const std::vector<uint8_t> ints = make_ints();
+    std::vector<int64_t> decoded;
+    decoded.reserve(256);
+    results.push_back(measure(counters, "unpack_ints", ints.size(), [&ints, &decoded]() -> uint64_t {
+        msgpack::unpacker u{ msgpack::buffer_view{ ints.data(), ints.size() }};
+        decoded.clear();
+        u >> decoded;
+        return static_cast<uint64_t>(decoded.back());
+    }, milliseconds));
+
+    // header dispatch only
+    const std::vector<uint8_t> batch = make_batch();
+    results.push_back(measure(counters, "skip", batch.size(), [&batch]() -> uint64_t {
+        msgpack::unpacker u{ msgpack::buffer_view{ batch.data(), batch.size() }};
+        u.skip();
+        return u.empty() ? 1 : 0;
+    }, milliseconds));
+
+    // struct decoding with and without the shape cache
+    const std::vector<uint8_t> metrics = make_metrics();
+    std::vector<metric> pool;
+    results.push_back(measure(counters, "fields", metrics.size(), [&metrics, &pool]() -> uint64_t {
+        return decode_metrics<pooled_traits>(metrics, pool);
+    }, milliseconds));
+    results.push_back(measure(counters, "fields_shape", metrics.size(), [&metrics, &pool]() -> uint64_t {
+        return decode_metrics<pooled_shape_traits>(metrics, pool);
+    }, milliseconds));
+
+    if (json) {
+        print_json(results);
+    } else {
+        print_table(results);
+    }
+    return 0;
+}
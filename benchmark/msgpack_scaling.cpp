@@ -0,0 +1,193 @@
+#include <packer.h>
+#include <unpacker.h>
+#include <parallel.h>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+//*****************************************************************************
+// Decode throughput from 1 to N threads. Every thread decodes the elements of
+// a batch through sub-unpackers or borrowed views, over one buffer shared by
+// all threads or a private copy each. Sub-unpackers of a shared buffer bump
+// its atomic reference count, borrowed views do not. Last, one large array of
+// records is decoded by a parallel_decoder with 1 to N threads.
+//
+//   msgpack_scaling [max threads] [milliseconds per run]
+//*****************************************************************************
+
+namespace {
+
+enum class mode {
+    shared_sub_unpackers,
+    shared_borrowed,
+    private_sub_unpackers,
+};
+
+const char* name(const mode m) {
+    switch (m) {
+        case mode::shared_sub_unpackers:
+            return "shared buffer, sub-unpackers";
+        case mode::shared_borrowed:
+            return "shared buffer, borrowed views";
+        default:
+            return "private buffers, sub-unpackers";
+    }
+}
+
+std::vector<uint8_t> make_batch() {
+    msgpack::packer p;
+    std::vector<msgpack::packer> events(64);
+    for (size_t i = 0; i < events.size(); ++i) {
+        events[i].map("id", static_cast<uint64_t>(i), "name", "event", "values", std::vector<int>(8, static_cast<int>(i)));
+    }
+    p << events;
+    return p.get_buffer();
+}
+
+uint64_t decode_event(msgpack::unpacker& e) {
+    uint64_t sum = 0;
+    e.for_each<std::string, msgpack::unpacker>([&sum](const std::string& key, msgpack::unpacker& value) {
+        if (key == "id") {
+            sum += value.get_value<uint64_t>();
+        } else {
+            value.skip();
+        }
+    });
+    return sum;
+}
+
+// decodes one batch, returns a checksum so the work is not optimized away
+uint64_t decode(const msgpack::unpacker& batch, const mode m) {
+    uint64_t sum = 0;
+    if (m == mode::shared_borrowed) {
+        msgpack::unpacker u = batch.borrow(batch.view());
+        u.for_each<msgpack::buffer_view>([&u, &sum](const msgpack::buffer_view& v) {
+            msgpack::unpacker e = u.borrow(v);
+            sum += decode_event(e);
+        });
+    } else {
+        msgpack::unpacker u{ batch };
+        u.for_each<msgpack::unpacker>([&sum](msgpack::unpacker& e) {
+            sum += decode_event(e);
+        });
+    }
+    return sum;
+}
+
+// batches per second over all threads
+double run(const std::vector<uint8_t>& buffer, const mode m, const unsigned threads, const int milliseconds) {
+    const msgpack::unpacker shared{ buffer };
+    std::atomic<bool> start{ false };
+    std::atomic<bool> stop{ false };
+    std::atomic<uint64_t> batches{ 0 };
+    std::atomic<uint64_t> checksum{ 0 };
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            const msgpack::unpacker own{ buffer };
+            const msgpack::unpacker& batch = m == mode::private_sub_unpackers ? own : shared;
+            uint64_t n = 0;
+            uint64_t sum = 0;
+            while (!start.load(std::memory_order_acquire)) {}
+            while (!stop.load(std::memory_order_relaxed)) {
+                sum += decode(batch, m);
+                ++n;
+            }
+            batches.fetch_add(n);
+            checksum.fetch_add(sum);
+        });
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds{ milliseconds });
+    stop.store(true);
+    for (std::thread& w : workers) { w.join(); }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+    if (checksum.load() == 0) { std::abort(); }
+    return static_cast<double>(batches.load()) / elapsed.count();
+}
+
+struct event {
+    uint64_t id = 0;
+    std::string name;
+    std::vector<int> values;
+
+    MSGPACK_FIELDS_BEGIN
+        MSGPACK_FIELD(id)
+        MSGPACK_FIELD(name)
+        MSGPACK_FIELD(values)
+    MSGPACK_FIELDS_END
+};
+
+std::vector<uint8_t> make_document(const size_t events) {
+    msgpack::packer p;
+    p.begin_array();
+    for (size_t i = 0; i < events; ++i) {
+        p.map("id", static_cast<uint64_t>(i), "name", "event " + std::to_string(i), "values",
+              std::vector<int>(8, static_cast<int>(i)));
+    }
+    p.end_array();
+    return p.get_buffer();
+}
+
+// documents per second, decoded one after another
+double run_document(const std::vector<uint8_t>& buffer, const unsigned threads, const int milliseconds) {
+    msgpack::parallel_decoder decoder{ threads };
+    std::vector<event> events;
+    uint64_t documents = 0;
+    uint64_t checksum = 0;
+    const auto begin = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed{ 0 };
+    while (elapsed.count() * 1000 < milliseconds) {
+        msgpack::unpacker u{ msgpack::buffer_view{ buffer.data(), buffer.size() }};
+        events.clear();
+        if (decoder.decode(u, events) != msgpack::E_OK) { std::abort(); }
+        checksum += events.back().id;
+        ++documents;
+        elapsed = std::chrono::steady_clock::now() - begin;
+    }
+    if (checksum == 0) { std::abort(); }
+    return static_cast<double>(documents) / elapsed.count();
+}
+
+}
+
+int main(int argc, char** argv) {
+    const unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+    const unsigned max_threads = argc > 1 ? static_cast<unsigned>(std::atoi(argv[1])) : hardware;
+    const int milliseconds = argc > 2 ? std::atoi(argv[2]) : 500;
+    const std::vector<uint8_t> buffer = make_batch();
+    const auto next = [max_threads](const unsigned threads) {
+        return threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2;
+    };
+
+    for (const mode m : { mode::shared_sub_unpackers, mode::shared_borrowed, mode::private_sub_unpackers }) {
+        printf("%s, %zu byte batches\n", name(m), buffer.size());
+        double single = 0;
+        for (unsigned threads = 1; threads <= max_threads; threads = next(threads)) {
+            const double rate = run(buffer, m, threads, milliseconds);
+            if (threads == 1) { single = rate; }
+            printf("%4u threads: %12.0f batches/s, %6.2fx\n", threads, rate, rate / single);
+            if (threads == max_threads) { break; }
+        }
+    }
+
+    const std::vector<uint8_t> document = make_document(1000000);
+    printf("one document, parallel decoder, %zu bytes\n", document.size());
+    double single = 0;
+    for (unsigned threads = 1; threads <= max_threads; threads = next(threads)) {
+        const double rate = run_document(document, threads, milliseconds);
+        if (threads == 1) { single = rate; }
+        printf("%4u threads: %12.2f documents/s, %6.2fx\n", threads, rate, rate / single);
+        if (threads == max_threads) { break; }
+    }
+    return 0;
+}
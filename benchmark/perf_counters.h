@@ -0,0 +1,126 @@
+#ifndef MSGPACK_PERF_COUNTERS_H
+#define MSGPACK_PERF_COUNTERS_H
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//*****************************************************************************
+// Hardware counters of the calling thread through perf_event_open. Every
+// counter is opened on its own so the ones a machine lacks, or a virtual
+// machine does not expose, are reported as unavailable while the others
+// still count. Values are scaled up when the kernel multiplexed a counter.
+// Without perf events, e.g. outside Linux, nothing is available.
+//*****************************************************************************
+
+namespace perf {
+
+enum counter_t {
+    C_CYCLES,
+    C_INSTRUCTIONS,
+    C_BRANCH_MISSES,
+    C_L1D_MISSES,
+    C_LLC_MISSES,
+    C_COUNT,
+};
+
+inline const char* name(const counter_t c) {
+    static const char* const names[C_COUNT] = { "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses" };
+    return names[c];
+}
+
+class counters {
+public:
+    counters() {
+        for (int& fd : _fd) { fd = -1; }
+        memset(_values, 0, sizeof(_values));
+#if defined(__linux__)
+        const uint64_t read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        open(C_CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        open(C_INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        open(C_BRANCH_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        open(C_L1D_MISSES, PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | read_miss);
+        open(C_LLC_MISSES, PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | read_miss);
+#endif
+    }
+
+    counters(const counters&) = delete;
+    counters& operator=(const counters&) = delete;
+
+    ~counters() {
+#if defined(__linux__)
+        for (const int fd : _fd) {
+            if (fd >= 0) { ::close(fd); }
+        }
+#endif
+    }
+
+    bool available(const counter_t c) const { return _fd[c] >= 0; }
+
+    bool any_available() const {
+        for (const int fd : _fd) {
+            if (fd >= 0) { return true; }
+        }
+        return false;
+    }
+
+    // resets and enables every available counter
+    void start() {
+#if defined(__linux__)
+        for (const int fd : _fd) {
+            if (fd < 0) { continue; }
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // disables the counters and reads the counts since start()
+    void stop() {
+#if defined(__linux__)
+        for (const int fd : _fd) {
+            if (fd >= 0) { ioctl(fd, PERF_EVENT_IOC_DISABLE, 0); }
+        }
+        for (int c = 0; c < C_COUNT; ++c) {
+            _values[c] = 0;
+            if (_fd[c] < 0) { continue; }
+            // value, time enabled and time running
+            uint64_t v[3];
+            if (::read(_fd[c], v, sizeof(v)) != static_cast<ssize_t>(sizeof(v)) || v[2] == 0) { continue; }
+            _values[c] = v[2] < v[1] ? static_cast<uint64_t>(static_cast<double>(v[0]) * v[1] / v[2]) : v[0];
+        }
+#endif
+    }
+
+    uint64_t value(const counter_t c) const { return _values[c]; }
+
+private:
+    int _fd[C_COUNT];
+    uint64_t _values[C_COUNT];
+
+#if defined(__linux__)
+    void open(const counter_t c, const uint32_t type, const uint64_t config) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        // user space only, allowed with the default perf_event_paranoid of 2
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        _fd[c] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+};
+
+}
+
+#endif //MSGPACK_PERF_COUNTERS_H
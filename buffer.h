@@ -0,0 +1,239 @@
+#ifndef MSGPACK_BUFFER_H
+#define MSGPACK_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+// std::pmr memory resources for the allocator aware packers and unpackers
+#if __cplusplus >= 201703L && defined(__has_include)
+#   if __has_include(<memory_resource>)
+#       include <memory_resource>
+#       define MSGPACK_HAS_PMR 1
+#   endif
+#endif
+#ifndef MSGPACK_HAS_PMR
+#   define MSGPACK_HAS_PMR 0
+#endif
+
+namespace msgpack {
+
+// non-owning view of encoded bytes
+struct buffer_view {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    buffer_view() = default;
+    buffer_view(const uint8_t* d, size_t s) : data(d), size(s) {}
+
+    const uint8_t* begin() const { return data; }
+    const uint8_t* end() const { return data + size; }
+    bool empty() const { return size == 0; }
+
+    std::vector<uint8_t> to_vector() const { return std::vector<uint8_t>(begin(), end()); }
+};
+
+// Byte buffer with N bytes of inline storage, spilling to the heap on overflow. Supports the
+// subset of the std::vector interface used by the packer. resize() does not initialize bytes.
+template<size_t N> class small_buffer {
+public:
+    using value_type = uint8_t;
+    using iterator = uint8_t*;
+    using const_iterator = const uint8_t*;
+
+    static constexpr size_t inline_capacity = N;
+
+    small_buffer() : _data(_inline), _size(0), _capacity(N) {}
+
+    small_buffer(const small_buffer& other) : small_buffer() {
+        insert(end(), other.begin(), other.end());
+    }
+
+    small_buffer(small_buffer&& other) noexcept : small_buffer() {
+        take(other);
+    }
+
+    small_buffer& operator=(const small_buffer& other) {
+        if (this != &other) {
+            clear();
+            insert(end(), other.begin(), other.end());
+        }
+        return *this;
+    }
+
+    small_buffer& operator=(small_buffer&& other) noexcept {
+        if (this != &other) {
+            release();
+            take(other);
+        }
+        return *this;
+    }
+
+    ~small_buffer() {
+        release();
+    }
+
+    void push_back(const uint8_t b) {
+        if (_size == _capacity) { grow(_size + 1); }
+        _data[_size++] = b;
+    }
+
+    void emplace_back(const uint8_t b) { push_back(b); }
+
+    // appends, pos has to be end()
+    template<typename It> void insert(const_iterator pos, It first, It last) {
+        (void) pos;
+        const size_t n = static_cast<size_t>(std::distance(first, last));
+        reserve(_size + n);
+        std::copy(first, last, _data + _size);
+        _size += n;
+    }
+
+    void resize(const size_t n) {
+        reserve(n);
+        _size = n;
+    }
+
+    void reserve(const size_t n) {
+        if (n > _capacity) { grow(n); }
+    }
+
+    void clear() { _size = 0; }
+
+    uint8_t* data() { return _data; }
+    const uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+    size_t capacity() const { return _capacity; }
+    bool empty() const { return _size == 0; }
+    bool on_heap() const { return _data != _inline; }
+
+    iterator begin() { return _data; }
+    iterator end() { return _data + _size; }
+    const_iterator begin() const { return _data; }
+    const_iterator end() const { return _data + _size; }
+    const_iterator cbegin() const { return _data; }
+    const_iterator cend() const { return _data + _size; }
+
+private:
+    uint8_t _inline[N > 0 ? N : 1];
+    uint8_t* _data;
+    size_t _size;
+    size_t _capacity;
+
+    void release() {
+        if (on_heap()) { delete[] _data; }
+        _data = _inline;
+        _size = 0;
+        _capacity = N;
+    }
+
+    // steals the heap storage of other or copies its inline bytes, this has to be empty
+    void take(small_buffer& other) {
+        if (other.on_heap()) {
+            _data = other._data;
+            _capacity = other._capacity;
+            other._data = other._inline;
+            other._capacity = N;
+        } else {
+            memcpy(_inline, other._inline, other._size);
+        }
+        _size = other._size;
+        other._size = 0;
+    }
+
+    void grow(const size_t n) {
+        const size_t capacity = std::max(n, 2 * _capacity);
+        uint8_t* data = new uint8_t[capacity];
+        memcpy(data, _data, _size);
+        if (on_heap()) { delete[] _data; }
+        _data = data;
+        _capacity = capacity;
+    }
+};
+
+// Byte buffer writing into external storage, for example a slot reserved in a ring. Bytes
+// beyond the storage spill to the heap, spilled() tells whether the storage was too small.
+class span_buffer {
+public:
+    using value_type = uint8_t;
+    using iterator = uint8_t*;
+    using const_iterator = const uint8_t*;
+
+    span_buffer() : span_buffer(nullptr, 0) {}
+    span_buffer(uint8_t* data, size_t capacity)
+            : _storage(data), _storage_capacity(capacity), _data(data), _size(0), _capacity(capacity) {}
+
+    span_buffer(span_buffer&& other) noexcept
+            : _storage(other._storage), _storage_capacity(other._storage_capacity), _data(other._data),
+              _size(other._size), _capacity(other._capacity), _spill(std::move(other._spill)) {
+        other._data = other._storage;
+        other._size = 0;
+        other._capacity = other._storage_capacity;
+    }
+
+    span_buffer(const span_buffer&) = delete;
+    span_buffer& operator=(const span_buffer&) = delete;
+
+    void push_back(const uint8_t b) {
+        if (_size == _capacity) { grow(_size + 1); }
+        _data[_size++] = b;
+    }
+
+    void emplace_back(const uint8_t b) { push_back(b); }
+
+    // appends, pos has to be end()
+    template<typename It> void insert(const_iterator pos, It first, It last) {
+        (void) pos;
+        const size_t n = static_cast<size_t>(std::distance(first, last));
+        reserve(_size + n);
+        std::copy(first, last, _data + _size);
+        _size += n;
+    }
+
+    void resize(const size_t n) {
+        reserve(n);
+        _size = n;
+    }
+
+    void reserve(const size_t n) {
+        if (n > _capacity) { grow(n); }
+    }
+
+    void clear() { _size = 0; }
+
+    uint8_t* data() { return _data; }
+    const uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+    size_t capacity() const { return _capacity; }
+    bool empty() const { return _size == 0; }
+    bool spilled() const { return _data != _storage; }
+
+    iterator begin() { return _data; }
+    iterator end() { return _data + _size; }
+    const_iterator begin() const { return _data; }
+    const_iterator end() const { return _data + _size; }
+    const_iterator cbegin() const { return _data; }
+    const_iterator cend() const { return _data + _size; }
+
+private:
+    uint8_t* const _storage;
+    const size_t _storage_capacity;
+    uint8_t* _data;
+    size_t _size;
+    size_t _capacity;
+    std::vector<uint8_t> _spill;
+
+    void grow(const size_t n) {
+        if (!spilled()) { _spill.assign(_data, _data + _size); }
+        _spill.resize(std::max(n, 2 * _capacity));
+        _data = _spill.data();
+        _capacity = _spill.size();
+    }
+};
+
+}
+
+#endif //MSGPACK_BUFFER_H
@@ -0,0 +1,166 @@
+#ifndef MSGPACK_COLUMNS_H
+#define MSGPACK_COLUMNS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "buffer.h"
+#include "packer.h"
+#include "unpacker.h"
+
+//*****************************************************************************
+// Columnar decoding and encoding of record batches, arrays of maps sharing
+// their keys. Every column binds a key to a typed vector, decoding appends
+// one element per record to every column and encoding packs the columns back
+// as an array of maps. Keys are matched on their contents, whatever the width
+// of their string header; the key after the last match is tried first since
+// records usually share their order.
+//
+//   std::vector<int64_t> ids;
+//   std::vector<std::string> names;
+//   msgpack::column_set columns;
+//   columns.column("id", ids).column("name", names);
+//   columns.decode(u);
+//*****************************************************************************
+
+namespace msgpack {
+
+template<typename Unpacker = unpacker, typename Packer = packer> class basic_column_set {
+public:
+    using unpacker_type = Unpacker;
+    using packer_type = Packer;
+
+    // binds key to values, records without the key get a value initialized element
+    template<typename T> basic_column_set& column(const std::string& key, std::vector<T>& values) {
+        _columns.push_back(entry{ key, &values, &column_ops<T>::size, &column_ops<T>::append, &column_ops<T>::resize,
+                                  &column_ops<T>::pack, false });
+        return *this;
+    }
+
+    // records in the columns, the size of the first one
+    size_t rows() const {
+        return _columns.empty() ? 0 : _columns.front().size(_columns.front().values);
+    }
+
+    // Appends the records of an array of maps, unknown keys are skipped and repeated keys
+    // keep their first value. On error the records of the batch are removed again.
+    inline error_code_t decode(unpacker_type& u);
+
+    // packs the columns as an array of maps, all columns have to hold rows() elements
+    inline void encode(packer_type& p) const;
+
+private:
+    struct entry {
+        std::string name;
+        void* values;
+        size_t (* size)(const void*);
+        error_code_t (* append)(unpacker_type&, void*);
+        void (* resize)(void*, size_t);
+        void (* pack)(packer_type&, const void*, size_t);
+        bool filled;
+    };
+
+    template<typename T> struct column_ops {
+        static size_t size(const void* v) { return static_cast<const std::vector<T>*>(v)->size(); }
+
+        static error_code_t append(unpacker_type& u, void* v) {
+            std::vector<T>& values = *static_cast<std::vector<T>*>(v);
+            T value{};
+            MSGPACK_TRY(u.try_get(value));
+            values.push_back(std::move(value));
+            return E_OK;
+        }
+
+        static void resize(void* v, const size_t n) { static_cast<std::vector<T>*>(v)->resize(n); }
+
+        static void pack(packer_type& p, const void* v, const size_t row) {
+            p << (*static_cast<const std::vector<T>*>(v))[row];
+        }
+    };
+
+    std::vector<entry> _columns;
+
+    inline error_code_t decode_row(unpacker_type& u, size_t row);
+    inline entry* find(buffer_view key, size_t& hint);
+};
+
+using column_set = basic_column_set<>;
+
+template<typename Unpacker, typename Packer>
+error_code_t basic_column_set<Unpacker, Packer>::decode(unpacker_type& u) {
+    const size_t first = rows();
+    size_t count;
+    MSGPACK_TRY(u.try_array_header(count));
+
+    for (size_t i = 0; i < count; ++i) {
+        const error_code_t e = decode_row(u, first + i);
+        if (e != E_OK) {
+            for (entry& c : _columns) { c.resize(c.values, first); }
+            return e;
+        }
+    }
+    return E_OK;
+}
+
+template<typename Unpacker, typename Packer>
+error_code_t basic_column_set<Unpacker, Packer>::decode_row(unpacker_type& u, const size_t row) {
+    size_t fields;
+    MSGPACK_TRY(u.try_map_header(fields));
+
+    for (entry& c : _columns) { c.filled = false; }
+    size_t hint = 0;
+    for (size_t i = 0; i < fields; ++i) {
+        buffer_view key;
+        MSGPACK_TRY(u.try_get(key));
+        buffer_view contents;
+        entry* c = string_contents(key, contents) ? find(contents, hint) : nullptr;
+        if (c == nullptr || c->filled) {
+            MSGPACK_TRY(u.try_skip());
+            continue;
+        }
+        MSGPACK_TRY(c->append(u, c->values));
+        c->filled = true;
+    }
+
+    for (entry& c : _columns) {
+        if (!c.filled) { c.resize(c.values, row + 1); }
+    }
+    return E_OK;
+}
+
+template<typename Unpacker, typename Packer>
+typename basic_column_set<Unpacker, Packer>::entry*
+basic_column_set<Unpacker, Packer>::find(const buffer_view key, size_t& hint) {
+    const size_t n = _columns.size();
+    for (size_t i = 0; i < n; ++i) {
+        const size_t index = hint + i < n ? hint + i : hint + i - n;
+        entry& c = _columns[index];
+        if (c.name.size() == key.size && memcmp(c.name.data(), key.data, key.size) == 0) {
+            hint = index + 1;
+            return &c;
+        }
+    }
+    return nullptr;
+}
+
+template<typename Unpacker, typename Packer>
+void basic_column_set<Unpacker, Packer>::encode(packer_type& p) const {
+    // the lengths are known, the headers are written up front instead of patched
+    const size_t n = rows();
+    p.put_array_length(n);
+    typename packer_type::nested_scope rows_scope{ p };
+    for (size_t row = 0; row < n; ++row) {
+        p.put_map_length(_columns.size());
+        typename packer_type::nested_scope fields_scope{ p };
+        for (const entry& c : _columns) {
+            p << c.name;
+            c.pack(p, c.values, row);
+        }
+    }
+}
+
+}
+
+#endif //MSGPACK_COLUMNS_H
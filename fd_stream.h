@@ -0,0 +1,315 @@
+#ifndef MSGPACK_FD_STREAM_H
+#define MSGPACK_FD_STREAM_H
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "buffer.h"
+#include "packer.h"
+#include "platform.h"
+#include "types.h"
+#include "unpacker.h"
+
+#if defined(__linux__)
+#   include <sys/epoll.h>
+#endif
+
+//*****************************************************************************
+// Framing of top-level msgpack values over non-blocking file descriptors.
+// frame_reader reads into a reusable buffer and hands out views of complete
+// values, frame_writer coalesces queued frames into writev calls. System
+// call failures are returned as errno values, EAGAIN is not a failure.
+//*****************************************************************************
+
+namespace msgpack {
+
+class frame_reader {
+public:
+    static constexpr size_t default_chunk_size = 64 * 1024;
+    static constexpr size_t default_max_frame_size = 16 * 1024 * 1024;
+
+    // Values larger than max_frame_size or nested deeper than max_depth are rejected as soon
+    // as their headers arrive, so a peer cannot make the reader buffer or recurse without bound.
+    explicit frame_reader(size_t chunk_size = default_chunk_size, size_t max_frame_size = default_max_frame_size,
+                          size_t max_depth = validated_buffer::default_max_depth)
+            : _chunk_size(chunk_size), _max_frame_size(max_frame_size), _max_depth(max_depth) {}
+
+    // Reads until the fd would block, invalidates the views handed out since the last consume().
+    // EBADMSG once the input is not msgpack or breaks the limits above.
+    inline int read(int fd);
+
+    // true once the peer closed the connection
+    bool closed() const { return _closed; }
+
+    // Appends views of the complete values received since the last call. Values are scanned
+    // as bytes arrive, an incomplete one resumes where the previous scan stopped. E_DEPTH for
+    // nesting deeper than max_depth, E_CONVERSION for invalid bytes or frames too large.
+    inline error_code_t frames(std::vector<buffer_view>& out);
+
+    // drops the frames handed out so far
+    void consume() {
+        _begin = _scanned;
+        if (_begin == _end) { _begin = _scanned = _complete = _end = 0; }
+    }
+
+    // bytes received and not consumed
+    size_t buffered() const { return _end - _begin; }
+
+private:
+    std::vector<uint8_t> _buffer;
+    // consumed up to _begin, handed out up to _scanned, complete values up to _complete
+    size_t _begin = 0;
+    size_t _scanned = 0;
+    size_t _complete = 0;
+    size_t _end = 0;
+    // ends of the complete values not handed out yet
+    std::vector<size_t> _ends;
+    // the value after _complete: its next header and the values left in every open container
+    size_t _cursor = 0;
+    std::vector<size_t> _pending;
+    error_code_t _error = E_OK;
+    const size_t _chunk_size;
+    const size_t _max_frame_size;
+    const size_t _max_depth;
+    bool _closed = false;
+
+    inline void scan();
+};
+
+class frame_writer {
+public:
+    void push(std::vector<uint8_t> frame) {
+        if (frame.empty()) { return; }
+        _pending += frame.size();
+        _queue.emplace_back(std::move(frame));
+    }
+
+    void push(packer& p) { push(p.take_buffer()); }
+
+    void push(const buffer_view frame) { push(frame.to_vector()); }
+
+    // writes queued frames with as few writev calls as possible until the fd would block
+    inline int flush(int fd);
+
+    bool empty() const { return _queue.empty(); }
+
+    // bytes queued and not written
+    size_t pending() const { return _pending; }
+
+private:
+    static constexpr size_t max_iov = 64;
+
+    std::deque<std::vector<uint8_t>> _queue;
+    // bytes of the first frame already written
+    size_t _offset = 0;
+    size_t _pending = 0;
+};
+
+int frame_reader::read(const int fd) {
+    if (_error != E_OK) { return EBADMSG; }
+    if (_begin != 0) {
+        memmove(_buffer.data(), _buffer.data() + _begin, _end - _begin);
+        _scanned -= _begin;
+        _complete -= _begin;
+        _cursor -= _begin;
+        _end -= _begin;
+        for (size_t& e : _ends) { e -= _begin; }
+        _begin = 0;
+    }
+
+    for (;;) {
+        if (_buffer.size() - _end < _chunk_size) {
+            MSGPACK_STATS_GROWTH(_buffer);
+            _buffer.resize(_end + _chunk_size);
+        }
+
+        const size_t available = _buffer.size() - _end;
+        const ssize_t n = ::read(fd, _buffer.data() + _end, available);
+        if (n > 0) {
+            _end += static_cast<size_t>(n);
+            scan();
+            if (_error != E_OK) { return EBADMSG; }
+            // a short read drained the fd
+            if (static_cast<size_t>(n) < available) { return 0; }
+        } else if (n == 0) {
+            _closed = true;
+            return 0;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        } else {
+            return errno;
+        }
+    }
+}
+
+error_code_t frame_reader::frames(std::vector<buffer_view>& out) {
+    scan();
+    for (const size_t e : _ends) {
+        out.emplace_back(_buffer.data() + _scanned, e - _scanned);
+        _scanned = e;
+    }
+    _ends.clear();
+    return _error;
+}
+
+// Walks the headers after _cursor without recursion. A header or payload not received
+// completely is looked at again once more bytes arrived, everything before is not.
+void frame_reader::scan() {
+    while (_error == E_OK) {
+        if (_pending.empty()) {
+            if (_complete == _end) { return; }
+            _cursor = _complete;
+            _pending.push_back(1);
+        }
+
+        const size_t available = _end - _cursor;
+        if (available == 0) { return; }
+        const types::descriptor& d = types::describe(_buffer[_cursor]);
+        if (d.type == types::T_UNKNOWN) {
+            _error = E_CONVERSION;
+            return;
+        }
+        if (available < size_t{ 1 } + d.length) { return; }
+
+        size_t len = d.value;
+        const uint8_t* length = _buffer.data() + _cursor + 1;
+        switch (d.length) {
+            case 1:
+                len = *length;
+                break;
+            case 2:
+                len = platform::load_be<uint16_t>(length);
+                break;
+            case 4:
+                len = platform::load_be<uint32_t>(length);
+                break;
+            default:
+                break;
+        }
+
+        // strings, bin and ext are followed by their length, scalars only by their payload
+        const bool container = d.type == types::T_ARRAY || d.type == types::T_MAP;
+        size_t size = size_t{ 1 } + d.length + d.payload;
+        if (!container && (d.type == types::T_STRING || d.length != 0)) { size += len; }
+        if (_cursor - _complete + size > _max_frame_size) {
+            _error = E_CONVERSION;
+            return;
+        }
+        if (available < size) { return; }
+
+        _cursor += size;
+        --_pending.back();
+        const size_t count = d.type == types::T_MAP ? len * 2 : len;
+        if (container && count != 0) {
+            if (_pending.size() > _max_depth) {
+                _error = E_DEPTH;
+                return;
+            }
+            _pending.push_back(count);
+        }
+        while (!_pending.empty() && _pending.back() == 0) { _pending.pop_back(); }
+        if (_pending.empty()) {
+            _complete = _cursor;
+            _ends.push_back(_complete);
+        }
+    }
+}
+
+int frame_writer::flush(const int fd) {
+    while (!_queue.empty()) {
+        iovec iov[max_iov];
+        size_t count = 0;
+        for (auto it = _queue.begin(); it != _queue.end() && count < max_iov; ++it, ++count) {
+            const size_t skip = count == 0 ? _offset : 0;
+            iov[count].iov_base = it->data() + skip;
+            iov[count].iov_len = it->size() - skip;
+        }
+
+        const ssize_t n = ::writev(fd, iov, static_cast<int>(count));
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { return 0; }
+            return errno;
+        }
+
+        size_t written = static_cast<size_t>(n);
+        _pending -= written;
+        while (written != 0) {
+            const size_t left = _queue.front().size() - _offset;
+            if (written < left) {
+                _offset += written;
+                break;
+            }
+            written -= left;
+            _offset = 0;
+            _queue.pop_front();
+        }
+    }
+    return 0;
+}
+
+#if defined(__linux__)
+
+// Reader and writer of a non-blocking fd registered with an external epoll loop,
+// the fd is owned by the caller.
+class fd_connection {
+public:
+    explicit fd_connection(int fd, size_t chunk_size = frame_reader::default_chunk_size,
+                           size_t max_frame_size = frame_reader::default_max_frame_size)
+            : _fd(fd), _reader(chunk_size, max_frame_size) {}
+
+    int fd() const { return _fd; }
+    frame_reader& reader() { return _reader; }
+    frame_writer& writer() { return _writer; }
+
+    // the epoll interest, output readiness only while frames are queued
+    uint32_t events() const {
+        return EPOLLIN | EPOLLRDHUP | (_writer.empty() ? 0u : static_cast<uint32_t>(EPOLLOUT));
+    }
+
+    // flushes queued frames and passes every received one to f(buffer_view) in batches,
+    // EBADMSG if the input is not msgpack
+    template<typename F> int on_event(const uint32_t events, F f) {
+        if ((events & EPOLLOUT) != 0) {
+            const int e = _writer.flush(_fd);
+            if (e != 0) { return e; }
+        }
+        if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0) {
+            const int e = _reader.read(_fd);
+            if (e != 0) { return e; }
+        }
+
+        _frames.clear();
+        if (_reader.frames(_frames) != E_OK) { return EBADMSG; }
+        for (const buffer_view& frame : _frames) { f(frame); }
+        _reader.consume();
+        return 0;
+    }
+
+    bool closed() const { return _reader.closed(); }
+
+private:
+    const int _fd;
+    frame_reader _reader;
+    frame_writer _writer;
+    std::vector<buffer_view> _frames;
+};
+
+#endif
+
+}
+
+#endif
+
+#endif //MSGPACK_FD_STREAM_H
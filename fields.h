@@ -0,0 +1,96 @@
+#ifndef MSGPACK_FIELDS_H
+#define MSGPACK_FIELDS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+//*****************************************************************************
+// Decoding plans for structs encoded as maps. The field list expands to a
+// switch over the FNV-1a hash of the key bytes, its case labels are computed
+// at compile time, so two colliding field names fail to compile. A matched
+// field reports its id, its position in the list, which the unpacker caches
+// per key to jump straight to the member next time. Ids and key labels share
+// the switch, key labels have the top bit set to keep them apart.
+//
+//   struct event {
+//       int64_t id;
+//       std::string name;
+//
+//       MSGPACK_FIELDS_BEGIN
+//           MSGPACK_FIELD(id)
+//           MSGPACK_FIELD(name)
+//       MSGPACK_FIELDS_END
+//   };
+//*****************************************************************************
+
+namespace msgpack {
+
+// for the case labels only, it takes a stack frame per byte unless evaluated at compile time
+constexpr uint64_t key_hash(const char* key, size_t len, uint64_t h = 14695981039346656037ull) {
+    return len == 0 ? h : key_hash(key + 1, len - 1, (h ^ static_cast<uint8_t>(*key)) * 1099511628211ull);
+}
+
+// the same hash of keys read at run time
+inline uint64_t runtime_key_hash(const char* key, const size_t len) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; ++i) { h = (h ^ static_cast<uint8_t>(key[i])) * 1099511628211ull; }
+    return h;
+}
+
+// set in the case labels of keys, never in field ids
+constexpr uint64_t key_label_bit = uint64_t{ 1 } << 63;
+
+inline bool key_equals(const char* name, size_t name_len, const char* key, size_t key_len) {
+    return name_len == key_len && memcmp(name, key, key_len) == 0;
+}
+
+// true if T declares its fields for unpacker U
+template<typename T, typename U> struct has_fields {
+    template<typename C> static auto test(int) -> decltype(
+            std::declval<C&>().decode_field(std::declval<U&>(), uint64_t{}, static_cast<const char*>(nullptr), size_t{},
+                                            std::declval<size_t&>()),
+            std::true_type{});
+    template<typename> static std::false_type test(...);
+
+    static constexpr bool value = decltype(test<T>(0))::value;
+};
+
+}
+
+// Decodes the value of the key and sets _field to the id of its member, 0 if unknown. Without
+// a key _hash is an id returned before and the member is decoded without comparing keys. Ids
+// count from the first field, so they agree between translation units.
+#define MSGPACK_FIELDS_BEGIN \
+    template<typename _U> ::msgpack::error_code_t \
+    decode_field(_U& _u, const uint64_t _hash, const char* _key, const size_t _key_len, size_t& _field) { \
+        enum : uint64_t { _first_field = __COUNTER__ }; \
+        switch (_key != nullptr ? _hash | ::msgpack::key_label_bit : _hash) {
+
+// a member decoded from the key of the same name
+#define MSGPACK_FIELD(_M) MSGPACK_FIELD_NAMED(_M, #_M)
+
+// a member decoded from the given key
+#define MSGPACK_FIELD_NAMED(_M, _NAME) MSGPACK_FIELD_ID(_M, _NAME, __COUNTER__ - _first_field)
+
+// the counter is expanded once per field, as an argument
+#define MSGPACK_FIELD_ID(_M, _NAME, _ID) \
+            case ::msgpack::key_hash(_NAME, sizeof(_NAME) - 1) | ::msgpack::key_label_bit: \
+                if (!::msgpack::key_equals(_NAME, sizeof(_NAME) - 1, _key, _key_len)) { break; } \
+                _field = _ID; \
+                return _u.try_get(_M); \
+            case _ID: \
+                return _u.try_get(_M);
+
+// unknown keys are skipped
+#define MSGPACK_FIELDS_END \
+            default: \
+                break; \
+        } \
+        _field = 0; \
+        return _u.try_skip(); \
+    }
+
+#endif //MSGPACK_FIELDS_H
@@ -0,0 +1,266 @@
+#ifndef MSGPACK_MUTABLE_VIEW_H
+#define MSGPACK_MUTABLE_VIEW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "buffer.h"
+#include "platform.h"
+#include "timestamp.h"
+#include "types.h"
+#include "unpacker.h"
+
+//*****************************************************************************
+// In-place patching of packed messages. A mutable_view spans one encoded
+// value, find() walks array indices and map keys down to a nested value and
+// set() overwrites a scalar when the new value fits the width already
+// encoded. A forwarded message is patched without being unpacked and
+// repacked; values meant to be patched are packed with msgpack::fixed().
+//*****************************************************************************
+
+namespace msgpack {
+
+class mutable_view : public types {
+public:
+    mutable_view() = default;
+
+    // the first value in data, invalid unless data starts with a complete value
+    inline mutable_view(uint8_t* data, size_t size);
+
+    explicit mutable_view(std::vector<uint8_t>& buffer) : mutable_view(buffer.data(), buffer.size()) {}
+
+    bool valid() const { return _data != nullptr; }
+
+    data_type_t type() const {
+        return valid() ? static_cast<data_type_t>(describe(*_data).type) : T_UNKNOWN;
+    }
+
+    // the encoded value, e.g. to read it with an unpacker
+    buffer_view view() const { return buffer_view{ _data, _size }; }
+
+    // Element of an array or value of a string key in a map, E_CONVERSION if this is
+    // not an array or map or the element is absent.
+    inline error_code_t find(size_t index, mutable_view& out) const;
+    inline error_code_t find(const char* key, size_t key_len, mutable_view& out) const;
+
+    error_code_t find(const std::string& key, mutable_view& out) const {
+        return find(key.data(), key.size(), out);
+    }
+
+    // walks a path of indices and keys, e.g. find_path(out, "route", 0, "ttl")
+    error_code_t find_path(mutable_view& out) const {
+        out = *this;
+        return valid() ? E_OK : E_CONVERSION;
+    }
+
+    template<typename K, typename ... _Path>
+    error_code_t find_path(mutable_view& out, const K& key, const _Path& ... path) const {
+        mutable_view next;
+        MSGPACK_TRY(step(key, next));
+        return next.find_path(out, path...);
+    }
+
+    // Overwrites the value, E_CONVERSION if its type differs or the new value does not fit
+    // the encoded width. Integers may change sign and header within the same width.
+    template<typename T> typename std::enable_if<std::is_same<bool, T>::value, error_code_t>::type
+    set(const T value) {
+        if (type() != T_BOOLEAN) { return E_CONVERSION; }
+        *_data = value ? 0xc3 : 0xc2;
+        return E_OK;
+    }
+
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<bool, T>::value, error_code_t>::type
+    set(const T value) {
+        return value < 0 ? set_int(static_cast<int64_t>(value)) : set_uint(static_cast<uint64_t>(value));
+    }
+
+    template<typename T> typename std::enable_if<std::is_floating_point<T>::value, error_code_t>::type
+    set(const T value) {
+        return set_double(static_cast<double>(value));
+    }
+
+    inline error_code_t set(const timestamp& ts);
+
+private:
+    uint8_t* _data = nullptr;
+    size_t _size = 0;
+
+    // the length held in the header of a string, array or map
+    static size_t length(const uint8_t* p, const descriptor& d) {
+        switch (d.length) {
+            case 0:
+                return d.value;
+            case 1:
+                return p[1];
+            case 2:
+                return platform::load_be<uint16_t>(p + 1);
+            default:
+                return platform::load_be<uint32_t>(p + 1);
+        }
+    }
+
+    bool is_integer() const {
+        const data_type_t t = type();
+        return t >= T_INT8 && t <= T_UINT64;
+    }
+
+    template<typename I> typename std::enable_if<std::is_integral<I>::value, error_code_t>::type
+    step(const I index, mutable_view& out) const {
+        // negative indices wrap around to absent elements
+        if (static_cast<int64_t>(index) < 0) { return E_CONVERSION; }
+        return find(static_cast<size_t>(index), out);
+    }
+
+    error_code_t step(const char* key, mutable_view& out) const { return find(key, strlen(key), out); }
+    error_code_t step(const std::string& key, mutable_view& out) const { return find(key, out); }
+
+    // the value starting at it, which lies within this one
+    mutable_view child(const uint8_t* it) const {
+        return mutable_view{ _data + (it - _data), _size - static_cast<size_t>(it - _data) };
+    }
+
+    inline error_code_t set_int(int64_t value);
+    inline error_code_t set_uint(uint64_t value);
+    inline error_code_t set_double(double value);
+};
+
+mutable_view::mutable_view(uint8_t* data, const size_t size) {
+    unpacker u{ buffer_view{ data, size }};
+    if (size != 0 && u.try_skip() == E_OK) {
+        _data = data;
+        _size = size - u.view().size;
+    }
+}
+
+error_code_t mutable_view::find(const size_t index, mutable_view& out) const {
+    if (type() != T_ARRAY) { return E_CONVERSION; }
+    const descriptor& d = describe(*_data);
+    if (index >= length(_data, d)) { return E_CONVERSION; }
+
+    const size_t header = 1u + d.length;
+    unpacker u{ buffer_view{ _data + header, _size - header }};
+    for (size_t i = 0; i < index; ++i) { MSGPACK_TRY(u.try_skip()); }
+    out = child(u.view().data);
+    return E_OK;
+}
+
+error_code_t mutable_view::find(const char* key, const size_t key_len, mutable_view& out) const {
+    if (type() != T_MAP) { return E_CONVERSION; }
+    const descriptor& d = describe(*_data);
+    const size_t count = length(_data, d);
+
+    const size_t header = 1u + d.length;
+    unpacker u{ buffer_view{ _data + header, _size - header }};
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t* k = u.view().data;
+        const descriptor& kd = describe(*k);
+        MSGPACK_TRY(u.try_skip());
+        if (kd.type == T_STRING && length(k, kd) == key_len && memcmp(k + 1 + kd.length, key, key_len) == 0) {
+            out = child(u.view().data);
+            return E_OK;
+        }
+        MSGPACK_TRY(u.try_skip());
+    }
+    return E_CONVERSION;
+}
+
+error_code_t mutable_view::set_int(const int64_t value) {
+    if (!is_integer()) { return E_CONVERSION; }
+    switch (_size) {
+        case 1:
+            if (value < -32) { return E_CONVERSION; }
+            *_data = static_cast<uint8_t>(value);
+            return E_OK;
+        case 2:
+            if (value < std::numeric_limits<int8_t>::min()) { return E_CONVERSION; }
+            _data[0] = 0xd0;
+            _data[1] = static_cast<uint8_t>(value);
+            return E_OK;
+        case 3:
+            if (value < std::numeric_limits<int16_t>::min()) { return E_CONVERSION; }
+            _data[0] = 0xd1;
+            platform::store_be(_data + 1, static_cast<int16_t>(value));
+            return E_OK;
+        case 5:
+            if (value < std::numeric_limits<int32_t>::min()) { return E_CONVERSION; }
+            _data[0] = 0xd2;
+            platform::store_be(_data + 1, static_cast<int32_t>(value));
+            return E_OK;
+        default:
+            _data[0] = 0xd3;
+            platform::store_be(_data + 1, value);
+            return E_OK;
+    }
+}
+
+error_code_t mutable_view::set_uint(const uint64_t value) {
+    if (!is_integer()) { return E_CONVERSION; }
+    switch (_size) {
+        case 1:
+            if (value > 0x7f) { return E_CONVERSION; }
+            *_data = static_cast<uint8_t>(value);
+            return E_OK;
+        case 2:
+            if (value > std::numeric_limits<uint8_t>::max()) { return E_CONVERSION; }
+            _data[0] = 0xcc;
+            _data[1] = static_cast<uint8_t>(value);
+            return E_OK;
+        case 3:
+            if (value > std::numeric_limits<uint16_t>::max()) { return E_CONVERSION; }
+            _data[0] = 0xcd;
+            platform::store_be(_data + 1, static_cast<uint16_t>(value));
+            return E_OK;
+        case 5:
+            if (value > std::numeric_limits<uint32_t>::max()) { return E_CONVERSION; }
+            _data[0] = 0xce;
+            platform::store_be(_data + 1, static_cast<uint32_t>(value));
+            return E_OK;
+        default:
+            _data[0] = 0xcf;
+            platform::store_be(_data + 1, value);
+            return E_OK;
+    }
+}
+
+error_code_t mutable_view::set_double(const double value) {
+    const data_type_t t = type();
+    if (t == T_DOUBLE) {
+        platform::store_be(_data + 1, value);
+        return E_OK;
+    }
+    if (t != T_FLOAT) { return E_CONVERSION; }
+
+    // a float slot takes values it represents exactly
+    const float f = static_cast<float>(value);
+    if (static_cast<double>(f) != value && value == value) { return E_CONVERSION; }
+    platform::store_be(_data + 1, f);
+    return E_OK;
+}
+
+error_code_t mutable_view::set(const timestamp& ts) {
+    if (type() != T_EXTERNAL) { return E_CONVERSION; }
+    const storage_type_t st = describe(*_data).storage;
+    if (st == SFEXT4 && _data[1] == static_cast<uint8_t>(timestamp::ext_type) && ts.fits_32()) {
+        platform::store_be(_data + 2, static_cast<uint32_t>(ts.seconds));
+        return E_OK;
+    }
+    if (st == SFEXT8 && _data[1] == static_cast<uint8_t>(timestamp::ext_type) && ts.fits_64()) {
+        platform::store_be(_data + 2, (uint64_t{ ts.nanoseconds } << 34) | static_cast<uint64_t>(ts.seconds));
+        return E_OK;
+    }
+    if (st == SEXT8 && _data[1] == 12 && _data[2] == static_cast<uint8_t>(timestamp::ext_type)) {
+        platform::store_be(_data + 3, ts.nanoseconds);
+        platform::store_be(_data + 7, ts.seconds);
+        return E_OK;
+    }
+    return E_CONVERSION;
+}
+
+}
+
+#endif //MSGPACK_MUTABLE_VIEW_H
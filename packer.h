@@ -1,80 +1,317 @@
 #ifndef MSGPACK_PACKER_H
 #define MSGPACK_PACKER_H
 
+#include <cassert>
 #include <limits>
+#include <cmath>
+#include <chrono>
 #include <string>
 #include <iterator>
 #include <algorithm>
 #include <cstring>
+#include <functional>
 #include <type_traits>
 #include <vector>
+#include "buffer.h"
 #include "platform.h"
-#include <codecvt>
+#include "stats.h"
+#include "timestamp.h"
+#include "trace.h"
+#include "types.h"
+#include "utf8.h"
 
 namespace msgpack {
 
-class packer {
-public:
+struct default_packer_traits {
+    using tracer = null_tracer;
     using buffer_type = std::vector<uint8_t>;
+    // integers at the full width of their type and timestamps in at least the 64-bit form,
+    // so they can be patched in place with any later value; deferred headers in the 32-bit
+    // form so they are never compacted
+    static constexpr bool fixed_width = false;
+    // flushes to a sink at a watermark, see basic_packer::sink()
+    static constexpr bool streaming = false;
+    // integral floating point values in the smallest integer form, other doubles as float32
+    // when that represents them exactly; ignored with fixed_width
+    static constexpr bool compact_floats = false;
+};
+
+// destination of a streaming packer, returns 0 or an errno value
+using sink_function = std::function<int(const uint8_t* data, size_t size)>;
+
+// the sink of streaming packers, empty otherwise
+template<bool Streaming> struct packer_sink {};
+
+template<> struct packer_sink<true> {
+    sink_function _sink;
+    size_t _watermark = std::numeric_limits<size_t>::max();
+    int _sink_error = 0;
+};
+
+// an integer or timestamp packed at full width regardless of the packer traits
+template<typename T> struct fixed_value {
+    T value;
+};
+
+template<typename T> fixed_value<T> fixed(const T value) {
+    return fixed_value<T>{ value };
+}
+
+// keeps messages of up to N bytes in the packer itself
+template<size_t N> struct small_packer_traits : default_packer_traits {
+    using buffer_type = small_buffer<N>;
+};
+
+struct streaming_packer_traits : default_packer_traits {
+    static constexpr bool streaming = true;
+};
+
+struct compact_packer_traits : default_packer_traits {
+    static constexpr bool compact_floats = true;
+};
+
+// packs into a vector allocated by Allocator, the packer takes the allocator of the buffer
+// it is constructed with
+template<typename Allocator> struct allocator_packer_traits : default_packer_traits {
+    using buffer_type = std::vector<uint8_t, Allocator>;
+};
+
+template<typename Traits = default_packer_traits> class basic_packer : private packer_sink<Traits::streaming> {
+public:
+    using traits_type = Traits;
+    using tracer = typename Traits::tracer;
+    using buffer_type = typename Traits::buffer_type;
 
     template <typename T> struct is_pair : std::false_type {};
     template <typename K, typename V> struct is_pair<std::pair<K, V>> : std::true_type {};
 
-    inline packer& operator<<(std::nullptr_t);
-    template<typename T> typename std::enable_if<std::is_same<bool, T>::value, packer&>::type
+    basic_packer() = default;
+
+    // packs into the given buffer, for example a span_buffer over external storage
+    explicit basic_packer(buffer_type buffer) : _buffer(std::move(buffer)) {}
+
+    inline basic_packer& operator<<(std::nullptr_t);
+    template<typename T> typename std::enable_if<std::is_same<bool, T>::value, basic_packer&>::type
     operator<<(const T value);
-    inline packer& operator<<(const int32_t value);
-    inline packer& operator<<(const int64_t value);
-    inline packer& operator<<(const uint32_t value);
-    inline packer& operator<<(const uint64_t value);
-    inline packer& operator<<(const float value);
-    inline packer& operator<<(const double value);
-    inline packer& operator<<(const std::string& str);
-    inline packer& operator<<(const std::wstring& str);
-    inline packer& operator<<(const char* str);
-    inline packer& operator<<(const packer& value);
-
-    template <typename T> typename std::enable_if<! std::is_fundamental<T>::value, packer&>::type
+    inline basic_packer& operator<<(const int32_t value);
+    inline basic_packer& operator<<(const int64_t value);
+    inline basic_packer& operator<<(const uint32_t value);
+    inline basic_packer& operator<<(const uint64_t value);
+    inline basic_packer& operator<<(const float value);
+    inline basic_packer& operator<<(const double value);
+    inline basic_packer& operator<<(const std::string& str);
+    inline basic_packer& operator<<(const std::wstring& str);
+    inline basic_packer& operator<<(const std::u16string& str);
+    inline basic_packer& operator<<(const std::u32string& str);
+    inline basic_packer& operator<<(const char* str);
+
+    // strings with other allocators, e.g. std::pmr::string
+    template<typename Allocator> basic_packer& operator<<(const std::basic_string<char, std::char_traits<char>, Allocator>& str) {
+        put_string_length(str.length());
+        put_bytes(reinterpret_cast<const uint8_t*>(str.data()), str.length());
+        return *this;
+    }
+
+    template<typename CharT, typename Allocator>
+    typename std::enable_if<!std::is_same<char, CharT>::value, basic_packer&>::type
+    operator<<(const std::basic_string<CharT, std::char_traits<CharT>, Allocator>& str) {
+        put_wide_string(str);
+        return *this;
+    }
+    inline basic_packer& operator<<(const basic_packer& value);
+    inline basic_packer& operator<<(const timestamp& ts);
+
+    // timestamp extension, durations are taken as offsets from the unix epoch
+    template<typename Duration>
+    basic_packer& operator<<(const std::chrono::time_point<std::chrono::system_clock, Duration>& tp) {
+        return *this << timestamp::from(tp.time_since_epoch());
+    }
+
+    template<typename Rep, typename Period> basic_packer& operator<<(const std::chrono::duration<Rep, Period>& d) {
+        return *this << timestamp::from(d);
+    }
+
+    template<typename T> basic_packer& operator<<(const fixed_value<T>& f) {
+        put_fixed(f.value);
+        return *this;
+    }
+
+    template <typename T> typename std::enable_if<! std::is_fundamental<T>::value, basic_packer&>::type
     operator <<(const T& val) {
         return put<T>(std::begin(val), std::end(val));
     }
 
-    template<typename T, size_t N> packer& operator<<(const T (& array)[N]);
+    template<typename T, size_t N> basic_packer& operator<<(const T (& array)[N]);
 
-    template <typename ... _Args> packer& array(const _Args& ... args) {
+    template <typename ... _Args> basic_packer& array(const _Args& ... args) {
         put_array_length(sizeof...(args));
+        nested_scope scope{ *this };
         int unused[] = { (this->operator<<(args), 0)... };
         (void) unused;
         return *this;
     }
 
-    template<typename K, typename V, typename ... _Args> packer& map(const K& k, const V& v, const _Args& ... args) {
+    template<typename K, typename V, typename ... _Args> basic_packer& map(const K& k, const V& v, const _Args& ... args) {
         put_map_length(sizeof...(args) / 2 + 1);
+        nested_scope scope{ *this };
         map_next(k, v, args...);
         return *this;
     }
 
+    // Array or map of a length unknown up front, e.g. packed from a generator. The values
+    // packed until the matching end_*() are counted, keys and values of a map alternate.
+    // The header is reserved in the 32-bit form and compacted to the smallest one at the
+    // end, which moves the values unless the traits ask for fixed_width. A packer appended
+    // in between counts as a single value.
+    basic_packer& begin_array() {
+        begin_scope(false);
+        return *this;
+    }
+
+    basic_packer& begin_map() {
+        begin_scope(true);
+        return *this;
+    }
+
+    basic_packer& end_array() {
+        end_scope(false);
+        return *this;
+    }
+
+    basic_packer& end_map() {
+        end_scope(true);
+        return *this;
+    }
+
     std::vector<uint8_t> get_buffer() const {
+        return std::vector<uint8_t>(_buffer.begin(), _buffer.end());
+    }
+
+    const buffer_type& buffer() const {
         return _buffer;
     }
 
+    // moves the encoded bytes out, leaving the packer empty
+    buffer_type take_buffer() {
+        buffer_type b{ std::move(_buffer) };
+        _buffer.clear();
+        return b;
+    }
+
+    // the encoded bytes, valid until the packer is modified
+    buffer_view view() const {
+        return buffer_view{ _buffer.data(), _buffer.size() };
+    }
+
+    // Streaming packers only. Whenever a value starts with watermark bytes or more buffered,
+    // they are written to the sink and dropped, and payloads of watermark bytes or more go
+    // to the sink directly, so memory stays bounded by the watermark plus the largest
+    // scalar. Bytes from the start of an open begin_array()/begin_map() are held back until
+    // it ends. After a sink error nothing is written anymore and bytes are dropped.
+    void sink(sink_function f, const size_t watermark) {
+        this->_sink = std::move(f);
+        this->_watermark = watermark;
+    }
+
+    // writes what is buffered, call it once packing is done; the first sink error
+    inline int flush();
+
+    int sink_error() const { return this->_sink_error; }
+
 private:
+    // encodes containers of known lengths like array() and map()
+    template<typename, typename> friend class basic_column_set;
+
+    // an array or map opened by begin_array() or begin_map()
+    struct deferred_scope {
+        size_t offset;
+        size_t count;
+        bool map;
+        // of the enclosing fixed-length containers, the scope counts its own values
+        size_t nesting;
+    };
+
+    // the elements of a fixed-length container, deferred scopes do not count them
+    struct nested_scope {
+        explicit nested_scope(basic_packer& p) : _packer(p) { ++_packer._nesting; }
+        ~nested_scope() { --_packer._nesting; }
+
+        nested_scope(const nested_scope&) = delete;
+        nested_scope& operator=(const nested_scope&) = delete;
+
+        basic_packer& _packer;
+        trace_scope<tracer> _trace;
+    };
+
     buffer_type _buffer;
+    std::vector<deferred_scope> _deferred;
+    size_t _nesting = 0;
+
+    void count_value() {
+        if (_nesting == 0 && !_deferred.empty()) { ++_deferred.back().count; }
+    }
+
+    inline void begin_scope(bool map);
+    inline void end_scope(bool map);
 
     void put_byte(const uint8_t b) {
+        MSGPACK_STATS_GROWTH(_buffer);
         _buffer.emplace_back(b);
+        MSGPACK_STATS_BUFFER(_buffer.size());
+    }
+
+    void put_bytes(const uint8_t* data, const size_t size) {
+        if (stream_bytes(data, size, std::integral_constant<bool, Traits::streaming>{})) { return; }
+        MSGPACK_STATS_GROWTH(_buffer);
+        _buffer.insert(_buffer.end(), data, data + size);
+        MSGPACK_STATS_BUFFER(_buffer.size());
+    }
+
+    void put_header(const uint8_t b) {
+        tracer::on_encode(types::storage_type(b));
+        count_value();
+        flush_at_watermark(std::integral_constant<bool, Traits::streaming>{});
+        put_byte(b);
+    }
+
+    void flush_at_watermark(std::false_type) {}
+
+    void flush_at_watermark(std::true_type) {
+        if (_buffer.size() >= this->_watermark) { flush(); }
+    }
+
+    bool stream_bytes(const uint8_t*, size_t, std::false_type) { return false; }
+
+    // large payloads bypass the buffer unless a deferred scope holds it back
+    bool stream_bytes(const uint8_t* data, const size_t size, std::true_type) {
+        if (size < this->_watermark || !_deferred.empty()) { return false; }
+        if (flush() == 0) { this->_sink_error = this->_sink(data, size); }
+        return true;
     }
 
     template<typename T> void put_numeric(const T t);
 
+    inline bool put_integral(double value, bool wide);
+
+    inline void put_fixed(int32_t value);
+    inline void put_fixed(int64_t value);
+    inline void put_fixed(uint32_t value);
+    inline void put_fixed(uint64_t value);
+    inline void put_fixed(const timestamp& ts);
+
+    // UTF-16 / UTF-32 transcoded to UTF-8 straight into the buffer
+    template<typename CharT, typename Allocator>
+    void put_wide_string(const std::basic_string<CharT, std::char_traits<CharT>, Allocator>& str);
+
     inline void put_string_length(size_t length);
     inline void put_array_length(size_t length);
     inline void put_map_length(size_t length);
 
     template<typename T, typename U = typename std::iterator_traits<typename T::const_iterator>::value_type>
-    typename std::enable_if<is_pair<U>::value, packer&>::type
+    typename std::enable_if<is_pair<U>::value, basic_packer&>::type
     put(typename T::const_iterator begin, typename T::const_iterator end) {
         put_map_length(static_cast<size_t>(std::distance(begin, end)));
+        nested_scope scope{ *this };
         std::for_each(begin, end, [this](const std::pair<typename U::first_type, typename U::second_type>& e) {
             *this << e.first;
             *this << e.second;
@@ -83,9 +320,10 @@ private:
     }
 
     template<typename T, typename U = typename std::iterator_traits<typename T::const_iterator>::value_type>
-    typename std::enable_if<! is_pair<U>::value, packer&>::type
+    typename std::enable_if<! is_pair<U>::value, basic_packer&>::type
     put(typename T::const_iterator begin, typename T::const_iterator end) {
         put_array_length(static_cast<size_t>(std::distance(begin, end)));
+        nested_scope scope{ *this };
         std::for_each(begin, end, [this](const U& e) {
             *this << e;
         });
@@ -106,116 +344,286 @@ private:
     };
 };
 
-packer& packer::operator<<(std::nullptr_t) {
-    put_byte(0xc0);
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(std::nullptr_t) {
+    put_header(0xc0);
     return *this;
 }
 
-template<typename T> typename std::enable_if<std::is_same<bool, T>::value, packer&>::type
-packer::operator<<(const T value) {
+template<typename Traits> template<typename T>
+typename std::enable_if<std::is_same<bool, T>::value, basic_packer<Traits>&>::type
+basic_packer<Traits>::operator<<(const T value) {
     if (value) {
-        put_byte(0xc3);
+        put_header(0xc3);
     } else {
-        put_byte(0xc2);
+        put_header(0xc2);
     }
     return *this;
 }
 
-packer& packer::operator<<(const int32_t value) {
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(const int32_t value) {
+    if (Traits::fixed_width) {
+        put_fixed(value);
+        return *this;
+    }
     if ((value >= 0 && value <= 0x7f) || (value < 0 && value >= -32)) {
-        put_byte(static_cast<uint8_t>(value));
+        put_header(static_cast<uint8_t>(value));
     } else if (value >= std::numeric_limits<int8_t>::min() && value <= std::numeric_limits<int8_t>::max()) {
-        put_byte(0xd0);
+        put_header(0xd0);
         put_byte(static_cast<uint8_t>(value));
     } else if (value >= std::numeric_limits<int16_t>::min() && value <= std::numeric_limits<int16_t>::max()) {
-        put_byte(0xd1);
+        put_header(0xd1);
         put_numeric(static_cast<const int16_t>(value));
     } else {
-        put_byte(0xd2);
+        put_header(0xd2);
         put_numeric(value);
     }
     return *this;
 }
 
-packer& packer::operator<<(const int64_t value) {
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(const int64_t value) {
+    if (Traits::fixed_width) {
+        put_fixed(value);
+        return *this;
+    }
     if (value >= std::numeric_limits<int32_t>::min() && value <= std::numeric_limits<int32_t>::max()) {
         *this << static_cast<int32_t>(value);
     } else {
-        put_byte(0xd3);
+        put_header(0xd3);
         put_numeric(value);
     }
 
     return *this;
 }
 
-packer& packer::operator<<(const uint32_t value) {
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(const uint32_t value) {
+    if (Traits::fixed_width) {
+        put_fixed(value);
+        return *this;
+    }
     if (value <= 0x7f) {
-        put_byte(static_cast<uint8_t>(value));
+        put_header(static_cast<uint8_t>(value));
     } else if (value <= std::numeric_limits<uint8_t>::max()) {
-        put_byte(0xcc);
+        put_header(0xcc);
         put_byte(static_cast<uint8_t>(value));
     } else if (value <= std::numeric_limits<uint16_t>::max()) {
-        put_byte(0xcd);
+        put_header(0xcd);
         put_numeric(static_cast<const int16_t>(value));
     } else {
-        put_byte(0xce);
+        put_header(0xce);
         put_numeric(value);
     }
     return *this;
 }
 
-packer& packer::operator<<(const uint64_t value) {
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(const uint64_t value) {
+    if (Traits::fixed_width) {
+        put_fixed(value);
+        return *this;
+    }
     if (value <= std::numeric_limits<uint32_t>::max()) {
         *this << static_cast<uint32_t>(value);
     } else {
-        put_byte(0xcf);
+        put_header(0xcf);
         put_numeric(value);
     }
 
     return *this;
 }
 
-packer& packer::operator<<(const float value) {
-    put_byte(0xca);
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(const float value) {
+    // integers beyond 32 bits take more than the 5 bytes of the float
+    if (Traits::compact_floats && !Traits::fixed_width && put_integral(value, false)) { return *this; }
+    put_header(0xca);
     put_numeric(value);
 
     return *this;
 }
 
-packer& packer::operator<<(const double value) {
-    put_byte(0xcb);
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(const double value) {
+    if (Traits::compact_floats && !Traits::fixed_width) {
+        // the smallest form first: integers of up to 5 bytes, floats, wider integers
+        if (put_integral(value, false)) { return *this; }
+        // NaN stays NaN, finite values beyond the float range cannot be converted
+        if (value != value || std::isinf(value) || std::fabs(value) <= std::numeric_limits<float>::max()) {
+            const float f = static_cast<float>(value);
+            if (static_cast<double>(f) == value || value != value) {
+                put_header(0xca);
+                put_numeric(f);
+                return *this;
+            }
+        }
+        if (put_integral(value, true)) { return *this; }
+    }
+    put_header(0xcb);
     put_numeric(value);
 
     return *this;
 }
 
-packer& packer::operator<<(const std::string& str) {
+// packs an integral value within the range of int32_t or uint32_t as an integer, of int64_t or
+// uint64_t if wide; -0.0 is left to the floating point forms to keep its sign
+template<typename Traits> bool basic_packer<Traits>::put_integral(const double value, const bool wide) {
+    if (value < 0) {
+        if (value < (wide ? -9223372036854775808.0 : -2147483648.0)) { return false; }
+        const int64_t i = static_cast<int64_t>(value);
+        if (static_cast<double>(i) != value) { return false; }
+        *this << i;
+        return true;
+    }
+    // also rejects NaN
+    if (!(value < (wide ? 18446744073709551616.0 : 4294967296.0)) || (value == 0 && std::signbit(value))) { return false; }
+    const uint64_t u = static_cast<uint64_t>(value);
+    if (static_cast<double>(u) != value) { return false; }
+    *this << u;
+    return true;
+}
+
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(const std::string& str) {
     put_string_length(str.length());
-    std::copy(str.data(), str.data() + str.length(), back_inserter(_buffer));
+    put_bytes(reinterpret_cast<const uint8_t*>(str.data()), str.length());
 
     return *this;
 }
 
-packer& packer::operator <<(const std::wstring& str) {
-    std::wstring_convert<std::codecvt_utf8<wchar_t>> cvt;
-    return *this << cvt.to_bytes(str);
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(const std::wstring& str) {
+    put_wide_string(str);
+    return *this;
 }
 
-packer& packer::operator<<(const char* str) {
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(const std::u16string& str) {
+    put_wide_string(str);
+    return *this;
+}
+
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(const std::u32string& str) {
+    put_wide_string(str);
+    return *this;
+}
+
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(const char* str) {
     const size_t len = strlen(str);
     put_string_length(len);
-    std::copy(str, str + len, back_inserter(_buffer));
+    put_bytes(reinterpret_cast<const uint8_t*>(str), len);
+
+    return *this;
+}
 
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(const basic_packer& value) {
+    count_value();
+    put_bytes(value._buffer.data(), value._buffer.size());
     return *this;
 }
 
-packer& packer::operator<<(const packer& value) {
-    _buffer.reserve(_buffer.size() + value._buffer.size());
-    _buffer.insert(_buffer.end(), value._buffer.cbegin(), value._buffer.cend());
+template<typename Traits> basic_packer<Traits>& basic_packer<Traits>::operator<<(const timestamp& ts) {
+    if (!Traits::fixed_width && ts.fits_32()) {
+        put_header(0xd6);
+        put_byte(static_cast<uint8_t>(timestamp::ext_type));
+        put_numeric(static_cast<uint32_t>(ts.seconds));
+    } else {
+        put_fixed(ts);
+    }
     return *this;
 }
 
-template<typename T> void packer::put_numeric(const T t) {
+template<typename Traits> void basic_packer<Traits>::begin_scope(const bool map) {
+    count_value();
+    tracer::enter();
+    const size_t offset = _buffer.size();
+    MSGPACK_STATS_GROWTH(_buffer);
+    _buffer.resize(offset + 5);
+    _deferred.push_back(deferred_scope{ offset, 0, map, _nesting });
+    _nesting = 0;
+}
+
+template<typename Traits> void basic_packer<Traits>::end_scope(const bool map) {
+    assert(!_deferred.empty() && "end_array()/end_map() without begin_array()/begin_map()");
+    assert(_deferred.back().map == map && "end_array()/end_map() does not match its begin");
+    assert((!map || _deferred.back().count % 2 == 0) && "a map scope holds keys and values in pairs");
+    assert(_nesting == 0 && "a fixed-length container is still open in the scope");
+    (void) map;
+    const deferred_scope scope = _deferred.back();
+    _deferred.pop_back();
+    _nesting = scope.nesting;
+    const size_t count = scope.map ? scope.count / 2 : scope.count;
+    tracer::on_length(scope.map ? types::T_MAP : types::T_ARRAY, count);
+
+    uint8_t header[5];
+    size_t size;
+    if (!Traits::fixed_width && count < 16) {
+        header[0] = static_cast<uint8_t>((scope.map ? 0x80u : 0x90u) + count);
+        size = 1;
+    } else if (!Traits::fixed_width && count <= std::numeric_limits<uint16_t>::max()) {
+        header[0] = scope.map ? 0xde : 0xdc;
+        platform::store_be(header + 1, static_cast<uint16_t>(count));
+        size = 3;
+    } else {
+        header[0] = scope.map ? 0xdf : 0xdd;
+        platform::store_be(header + 1, static_cast<uint32_t>(count));
+        size = 5;
+    }
+    tracer::on_encode(types::storage_type(header[0]));
+
+    uint8_t* data = _buffer.data() + scope.offset;
+    if (size != sizeof(header)) {
+        const size_t values = _buffer.size() - scope.offset - sizeof(header);
+        memmove(data + size, data + sizeof(header), values);
+        // buffers over memory read by others, e.g. ring slots, see no stale bytes past the end
+        memset(data + size + values, 0, sizeof(header) - size);
+        _buffer.resize(scope.offset + size + values);
+    }
+    memcpy(data, header, size);
+    tracer::leave();
+}
+
+template<typename Traits> int basic_packer<Traits>::flush() {
+    // the header of the outermost deferred scope is patched later
+    const size_t n = _deferred.empty() ? _buffer.size() : _deferred.front().offset;
+    if (n == 0 || !this->_sink) { return this->_sink_error; }
+    if (this->_sink_error == 0) { this->_sink_error = this->_sink(_buffer.data(), n); }
+
+    const size_t rest = _buffer.size() - n;
+    memmove(_buffer.data(), _buffer.data() + n, rest);
+    _buffer.resize(rest);
+    for (deferred_scope& scope : _deferred) { scope.offset -= n; }
+    return this->_sink_error;
+}
+
+template<typename Traits> void basic_packer<Traits>::put_fixed(const int32_t value) {
+    put_header(0xd2);
+    put_numeric(value);
+}
+
+template<typename Traits> void basic_packer<Traits>::put_fixed(const int64_t value) {
+    put_header(0xd3);
+    put_numeric(value);
+}
+
+template<typename Traits> void basic_packer<Traits>::put_fixed(const uint32_t value) {
+    put_header(0xce);
+    put_numeric(value);
+}
+
+template<typename Traits> void basic_packer<Traits>::put_fixed(const uint64_t value) {
+    put_header(0xcf);
+    put_numeric(value);
+}
+
+// the 64 or 96-bit form, whichever fits
+template<typename Traits> void basic_packer<Traits>::put_fixed(const timestamp& ts) {
+    if (ts.fits_64()) {
+        put_header(0xd7);
+        put_byte(static_cast<uint8_t>(timestamp::ext_type));
+        put_numeric((uint64_t{ ts.nanoseconds } << 34) | static_cast<uint64_t>(ts.seconds));
+    } else {
+        put_header(0xc7);
+        put_byte(12);
+        put_byte(static_cast<uint8_t>(timestamp::ext_type));
+        put_numeric(ts.nanoseconds);
+        put_numeric(ts.seconds);
+    }
+}
+
+template<typename Traits> template<typename T> void basic_packer<Traits>::put_numeric(const T t) {
     union {
         T data;
         uint8_t bytes[sizeof(T)];
@@ -224,53 +632,80 @@ template<typename T> void packer::put_numeric(const T t) {
     for (uint8_t b : cvt.bytes) { put_byte(b); }
 }
 
-template<typename T, size_t N> packer& packer::operator<<(const T (& array)[N]) {
+template<typename Traits> template<typename CharT, typename Allocator>
+void basic_packer<Traits>::put_wide_string(const std::basic_string<CharT, std::char_traits<CharT>, Allocator>& str) {
+    const size_t len = utf8::encoded_length(str.data(), str.size());
+    put_string_length(len);
+
+    MSGPACK_STATS_GROWTH(_buffer);
+    const size_t offset = _buffer.size();
+    _buffer.resize(offset + len);
+    utf8::encode(str.data(), str.size(), _buffer.data() + offset);
+    MSGPACK_STATS_BUFFER(_buffer.size());
+}
+
+template<typename Traits> template<typename T, size_t N>
+basic_packer<Traits>& basic_packer<Traits>::operator<<(const T (& array)[N]) {
     put_array_length(N);
+    nested_scope scope{ *this };
     std::for_each(array, array + N, [this] (const T& e) {
         *this << e;
     });
     return *this;
 }
 
-void packer::put_string_length(size_t length) {
+template<typename Traits> void basic_packer<Traits>::put_string_length(size_t length) {
+    tracer::on_length(types::T_STRING, length);
     if (length < 32) {
-        put_byte(uint8_t { 0xa0u } + static_cast<uint8_t>(length));
+        put_header(uint8_t { 0xa0u } + static_cast<uint8_t>(length));
     } else if (length <= std::numeric_limits<uint8_t>::max()) {
-        put_byte(0xd9);
+        put_header(0xd9);
         put_byte(static_cast<uint8_t>(length));
     } else if (length <= std::numeric_limits<uint16_t>::max()) {
-        put_byte(0xda);
+        put_header(0xda);
         put_numeric(static_cast<uint16_t>(length));
     } else if (length <= std::numeric_limits<uint32_t>::max()) {
-        put_byte(0xdb);
+        put_header(0xdb);
         put_numeric(static_cast<uint32_t>(length));
     }
 }
 
-void packer::put_array_length(size_t length) {
+template<typename Traits> void basic_packer<Traits>::put_array_length(size_t length) {
+    tracer::on_length(types::T_ARRAY, length);
     if (length < 16) {
-        put_byte(uint8_t { 0x90u } + static_cast<uint8_t>(length));
+        put_header(uint8_t { 0x90u } + static_cast<uint8_t>(length));
     } else if (length <= std::numeric_limits<uint16_t>::max()) {
-        put_byte(0xdc);
+        put_header(0xdc);
         put_numeric(static_cast<uint16_t>(length));
     } else if (length <= std::numeric_limits<uint32_t>::max()) {
-        put_byte(0xdd);
+        put_header(0xdd);
         put_numeric(static_cast<uint32_t>(length));
     }
 }
 
-void packer::put_map_length(size_t length) {
+template<typename Traits> void basic_packer<Traits>::put_map_length(size_t length) {
+    tracer::on_length(types::T_MAP, length);
     if (length < 16) {
-        put_byte(uint8_t { 0x80u } + static_cast<uint8_t>(length));
+        put_header(uint8_t { 0x80u } + static_cast<uint8_t>(length));
     } else if (length <= std::numeric_limits<uint16_t>::max()) {
-        put_byte(0xde);
+        put_header(0xde);
         put_numeric(static_cast<uint16_t>(length));
     } else if (length <= std::numeric_limits<uint32_t>::max()) {
-        put_byte(0xdf);
+        put_header(0xdf);
         put_numeric(static_cast<uint32_t>(length));
     }
 }
 
+using packer = basic_packer<>;
+using streaming_packer = basic_packer<streaming_packer_traits>;
+using compact_packer = basic_packer<compact_packer_traits>;
+template<size_t N> using small_packer = basic_packer<small_packer_traits<N>>;
+
+#if MSGPACK_HAS_PMR
+// packs into a std::pmr::vector, e.g. backed by a monotonic per request arena
+using pmr_packer = basic_packer<allocator_packer_traits<std::pmr::polymorphic_allocator<uint8_t>>>;
+#endif
+
 }
 
-#endif //MSGPACK_PACKER_H
+#endif //MSGPACK_PACKER_H
\ No newline at end of file
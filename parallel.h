@@ -0,0 +1,257 @@
+#ifndef MSGPACK_PARALLEL_H
+#define MSGPACK_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "buffer.h"
+#include "types.h"
+#include "unpacker.h"
+
+//*****************************************************************************
+// Decoding of one large array or map on several threads. The calling thread
+// skips over the elements and publishes where every chunk of them ends, which
+// touches headers only, while the other threads decode the chunks found so
+// far through borrowed unpackers straight into the pre-sized output. Chunks
+// are handed out one at a time so uneven elements still balance. The serial
+// skipping bounds the speedup, it pays off for elements costlier to decode
+// than to skip, such as strings, containers and structs, and hardly for plain
+// numbers.
+//
+//   std::vector<event> events;
+//   msgpack::parallel_decoder decoder;
+//   decoder.decode(u, events);
+//*****************************************************************************
+
+namespace msgpack {
+
+template<typename Unpacker = unpacker> class basic_parallel_decoder : public types {
+public:
+    using unpacker_type = Unpacker;
+
+    static constexpr size_t default_min_chunk = 1024;
+
+    // Threads including the calling one, 0 uses every core. Chunks hold at least min_chunk
+    // elements, smaller containers are decoded on the calling thread.
+    explicit basic_parallel_decoder(unsigned threads = 0, size_t min_chunk = default_min_chunk)
+            : _threads(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+              _min_chunk(std::max<size_t>(1, min_chunk)) {}
+
+    // Appends the elements of an array to vec. On error vec is restored to its previous
+    // size and the read position of u is left unchanged.
+    template<typename T, typename Allocator> inline error_code_t decode(unpacker_type& u, std::vector<T, Allocator>& vec);
+
+    // appends the entries of a map in their encoded order, otherwise as above
+    template<typename K, typename V, typename Allocator>
+    inline error_code_t decode(unpacker_type& u, std::vector<std::pair<K, V>, Allocator>& entries);
+
+    // Calls f(size_t index, T&) for every element of an array, concurrently from all threads
+    // and in no particular order. On error the read position of u is left unchanged.
+    template<typename T, typename F> inline error_code_t for_each(unpacker_type& u, F f);
+
+    unsigned threads() const { return _threads; }
+
+private:
+    // the first element of a chunk and where it starts, the last one ends the container
+    struct chunk {
+        size_t index;
+        const uint8_t* data;
+    };
+
+    const unsigned _threads;
+    const size_t _min_chunk;
+    std::vector<chunk> _chunks;
+#if MSGPACK_HAS_EXCEPTIONS
+    // thrown by a worker, rethrown once the output is restored
+    std::exception_ptr _exception;
+#endif
+
+    template<typename F> inline error_code_t run(unpacker_type& u, bool map, size_t len, F decode_element);
+    inline error_code_t scan(unpacker_type& u, bool map, size_t len, size_t size, std::atomic<size_t>& published);
+    inline void rethrow();
+};
+
+using parallel_decoder = basic_parallel_decoder<>;
+
+// The public functions work on a copy of their unpacker and only move it back on success.
+template<typename Unpacker> template<typename T, typename Allocator>
+error_code_t basic_parallel_decoder<Unpacker>::decode(unpacker_type& u, std::vector<T, Allocator>& vec) {
+    static_assert(!std::is_same<T, bool>::value, "the elements of std::vector<bool> cannot be written concurrently");
+    unpacker_type rest{ u };
+    size_t len;
+    MSGPACK_TRY(rest.try_array_header(len));
+    // every value takes at least a byte, a forged length must not size the output
+    if (len > rest.view().size) { return E_UNDERFLOW; }
+
+    const size_t first = vec.size();
+    vec.resize(first + len);
+    T* const out = vec.data() + first;
+    const error_code_t e = run(rest, false, len, [out](unpacker_type& b, const size_t i) { return b.try_get(out[i]); });
+    if (e != E_OK) {
+        vec.resize(first);
+        rethrow();
+        return e;
+    }
+    u = std::move(rest);
+    return E_OK;
+}
+
+template<typename Unpacker> template<typename K, typename V, typename Allocator>
+error_code_t basic_parallel_decoder<Unpacker>::decode(unpacker_type& u, std::vector<std::pair<K, V>, Allocator>& entries) {
+    unpacker_type rest{ u };
+    size_t len;
+    MSGPACK_TRY(rest.try_map_header(len));
+    // two values per entry
+    if (len > rest.view().size / 2) { return E_UNDERFLOW; }
+
+    const size_t first = entries.size();
+    entries.resize(first + len);
+    std::pair<K, V>* const out = entries.data() + first;
+    const error_code_t e = run(rest, true, len, [out](unpacker_type& b, const size_t i) {
+        MSGPACK_TRY(b.try_get(out[i].first));
+        return b.try_get(out[i].second);
+    });
+    if (e != E_OK) {
+        entries.resize(first);
+        rethrow();
+        return e;
+    }
+    u = std::move(rest);
+    return E_OK;
+}
+
+template<typename Unpacker> template<typename T, typename F>
+error_code_t basic_parallel_decoder<Unpacker>::for_each(unpacker_type& u, F f) {
+    unpacker_type rest{ u };
+    size_t len;
+    MSGPACK_TRY(rest.try_array_header(len));
+    // sizes the chunk list
+    if (len > rest.view().size) { return E_UNDERFLOW; }
+
+    const error_code_t e = run(rest, false, len, [&f](unpacker_type& b, const size_t i) {
+        T value{};
+        MSGPACK_TRY(b.try_get(value));
+        f(i, value);
+        return E_OK;
+    });
+    if (e != E_OK) {
+        rethrow();
+        return e;
+    }
+    u = std::move(rest);
+    return E_OK;
+}
+
+// Scans the len elements after the header on the calling thread, leaving u after the container,
+// and decodes the chunks published so far on the others. decode_element(unpacker_type&, size_t)
+// returns an error code. A scan error is returned first, otherwise the error of the first failing
+// chunk; the first exception is kept for rethrow().
+template<typename Unpacker> template<typename F>
+error_code_t basic_parallel_decoder<Unpacker>::run(unpacker_type& u, const bool map, const size_t len, F decode_element) {
+    // a few chunks per thread to balance, none smaller than _min_chunk
+    const size_t wanted = static_cast<size_t>(_threads) * 4;
+    const size_t size = std::max(_min_chunk, (len + wanted - 1) / wanted);
+    const size_t count = (len + size - 1) / size;
+    // written by index before they are published, the vector is never resized meanwhile
+    _chunks.resize(count + 1);
+
+    std::vector<error_code_t> errors(count, E_OK);
+    std::atomic<size_t> published{ 0 };
+    std::atomic<bool> failed{ false };
+    std::atomic<size_t> next{ 0 };
+#if MSGPACK_HAS_EXCEPTIONS
+    _exception = nullptr;
+    std::mutex exception_mutex;
+#endif
+
+    const auto work = [&]() {
+        for (size_t c = next.fetch_add(1, std::memory_order_relaxed); c < count; c = next.fetch_add(1, std::memory_order_relaxed)) {
+            // both ends of the chunk
+            while (published.load(std::memory_order_acquire) < c + 2) {
+                if (failed.load(std::memory_order_relaxed)) { return; }
+                std::this_thread::yield();
+            }
+
+            const chunk& begin = _chunks[c];
+            const chunk& end = _chunks[c + 1];
+            unpacker_type b = u.borrow(buffer_view{ begin.data, static_cast<size_t>(end.data - begin.data) });
+#if MSGPACK_HAS_EXCEPTIONS
+            try {
+#endif
+                for (size_t i = begin.index; i < end.index; ++i) {
+                    const error_code_t e = decode_element(b, i);
+                    if (e != E_OK) {
+                        errors[c] = e;
+                        break;
+                    }
+                }
+#if MSGPACK_HAS_EXCEPTIONS
+            } catch (...) {
+                const std::lock_guard<std::mutex> lock{ exception_mutex };
+                if (!_exception) { _exception = std::current_exception(); }
+                errors[c] = E_CONVERSION;
+            }
+#endif
+        }
+    };
+
+    std::vector<std::thread> workers;
+    const size_t helpers = std::min<size_t>(_threads, count) - (count != 0 ? 1 : 0);
+    workers.reserve(helpers);
+    for (size_t t = 0; t < helpers; ++t) { workers.emplace_back(work); }
+
+    // the calling thread decodes too once it has found every chunk
+    const error_code_t scanned = scan(u, map, len, size, published);
+    if (scanned != E_OK) {
+        failed.store(true, std::memory_order_relaxed);
+    } else {
+        work();
+    }
+    for (std::thread& t : workers) { t.join(); }
+
+    MSGPACK_TRY(scanned);
+    for (const error_code_t e : errors) {
+        if (e != E_OK) { return e; }
+    }
+    return E_OK;
+}
+
+// Skipping has to be serial, msgpack is not self-synchronizing and any byte may start a value.
+template<typename Unpacker>
+error_code_t basic_parallel_decoder<Unpacker>::scan(unpacker_type& u, const bool map, const size_t len, const size_t size,
+                                                    std::atomic<size_t>& published) {
+    size_t c = 0;
+    _chunks[0] = chunk{ 0, u.view().data };
+    published.store(1, std::memory_order_release);
+    for (size_t i = 0, left = size; i < len; ++i) {
+        MSGPACK_TRY(u.try_skip());
+        if (map) { MSGPACK_TRY(u.try_skip()); }
+        if (--left == 0 || i + 1 == len) {
+            _chunks[++c] = chunk{ i + 1, u.view().data };
+            published.store(c + 1, std::memory_order_release);
+            left = size;
+        }
+    }
+    return E_OK;
+}
+
+template<typename Unpacker> void basic_parallel_decoder<Unpacker>::rethrow() {
+#if MSGPACK_HAS_EXCEPTIONS
+    if (_exception) {
+        std::exception_ptr e;
+        std::swap(e, _exception);
+        std::rethrow_exception(e);
+    }
+#endif
+}
+
+}
+
+#endif //MSGPACK_PARALLEL_H
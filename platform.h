@@ -79,6 +79,7 @@
 #include <type_traits>
 #include <string>
 #include <cstdio>
+#include <cstring>
 
 namespace platform {
 template<typename T> constexpr typename std::enable_if<sizeof(T) == 1, T>::type byte_swap(const T t) {
@@ -126,6 +127,65 @@ constexpr uint16_t ntoh_s(const uint16_t t) { return ntoh(t); }
 constexpr uint32_t ntoh_l(const uint32_t t) { return ntoh(t); }
 constexpr uint64_t ntoh_q(const uint64_t t) { return ntoh(t); }
 
+// unaligned big endian load and store
+template<typename T> inline T load_be(const uint8_t* p) {
+    T t;
+    memcpy(&t, p, sizeof(T));
+    return ntoh(t);
+}
+
+template<typename T> inline void store_be(uint8_t* p, const T t) {
+    const T n = hton(t);
+    memcpy(p, &n, sizeof(T));
+}
+
+// compares n bytes, up to 16 with two overlapping loads each instead of a call
+inline bool equal_bytes(const uint8_t* a, const uint8_t* b, const size_t n) {
+    if (n > 16) { return memcmp(a, b, n) == 0; }
+    if (n >= 8) {
+        uint64_t a0, a1, b0, b1;
+        memcpy(&a0, a, 8);
+        memcpy(&a1, a + n - 8, 8);
+        memcpy(&b0, b, 8);
+        memcpy(&b1, b + n - 8, 8);
+        return ((a0 ^ b0) | (a1 ^ b1)) == 0;
+    }
+    if (n >= 4) {
+        uint32_t a0, a1, b0, b1;
+        memcpy(&a0, a, 4);
+        memcpy(&a1, a + n - 4, 4);
+        memcpy(&b0, b, 4);
+        memcpy(&b1, b + n - 4, 4);
+        return ((a0 ^ b0) | (a1 ^ b1)) == 0;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (a[i] != b[i]) { return false; }
+    }
+    return true;
+}
+
+// number of bits needed to represent the value, 0 for 0
+inline unsigned bit_width(const uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return v == 0 ? 0 : 64 - static_cast<unsigned>(__builtin_clzll(v));
+#else
+    unsigned n = 0;
+    for (uint64_t t = v; t != 0; t >>= 1) { ++n; }
+    return n;
+#endif
+}
+
+// index of the lowest set bit, v must not be 0
+inline unsigned trailing_zeros(const uint32_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctz(v));
+#else
+    unsigned n = 0;
+    for (uint32_t t = v; (t & 1u) == 0; t >>= 1) { ++n; }
+    return n;
+#endif
+}
+
 template<std::string::size_type N = 128, typename ... Args> std::string str_printf(const char* fmt, Args ...args) {
     std::string out;
     int size_used;
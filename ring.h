@@ -0,0 +1,247 @@
+#ifndef MSGPACK_RING_H
+#define MSGPACK_RING_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include "buffer.h"
+#include "packer.h"
+
+//*****************************************************************************
+// Lock-free ring of variable-length frames for handing messages between
+// threads without copies. Producers reserve a contiguous slot, pack into it
+// and commit; the single consumer reads the oldest frame in place and
+// releases it. Every frame starts with an 8-byte header holding the stride
+// to the next frame and the frame length, a header of zero is not committed
+// yet. Released bytes are zeroed so stale payload never looks committed.
+//*****************************************************************************
+
+namespace msgpack {
+
+// positions of the ring, may live in memory shared between processes
+struct frame_ring_control {
+    // producers and the consumer on separate cache lines, padded rather than over-aligned
+    // so the control block can be allocated with plain new
+    std::atomic<uint64_t> head{ 0 };
+    char head_padding[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> tail{ 0 };
+    char tail_padding[64 - sizeof(std::atomic<uint64_t>)];
+};
+
+template<bool MultiProducer> class basic_frame_ring {
+public:
+    static constexpr size_t header_size = sizeof(uint64_t);
+    // strides and lengths are stored in 32 bits of the frame header, frame lengths stay below
+    // the padding marker
+    static constexpr uint64_t max_capacity = uint64_t{ 1 } << 32;
+
+    // a reserved slot, committed or abandoned through the ring
+    struct reservation {
+        uint64_t position = 0;
+        uint8_t* data = nullptr;
+        size_t capacity = 0;
+        size_t padding = 0;
+    };
+
+    // capacity in bytes, rounded up to a power of two of at most max_capacity
+    explicit basic_frame_ring(size_t capacity)
+            : _owned_control(new frame_ring_control), _owned_words(new uint64_t[round_capacity(capacity) / 8]()),
+              _control(*_owned_control), _data(reinterpret_cast<uint8_t*>(_owned_words.get())),
+              _capacity(round_capacity(capacity)), _mask(_capacity - 1) {
+        static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "frame headers need lock-free 64-bit atomics");
+        static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "frame headers are stored in place");
+    }
+
+    // over external memory, e.g. shared with another process; data has to be zeroed and 8-byte
+    // aligned, capacity a power of two accepted by valid_capacity()
+    basic_frame_ring(frame_ring_control& control, void* data, size_t capacity)
+            : _control(control), _data(static_cast<uint8_t*>(data)), _capacity(capacity), _mask(capacity - 1) {
+        assert(valid_capacity(capacity) && "the capacity of a frame ring is a power of two up to max_capacity");
+    }
+
+    static bool valid_capacity(const size_t capacity) {
+        return capacity >= 2 * header_size && capacity <= max_capacity && (capacity & (capacity - 1)) == 0;
+    }
+
+    basic_frame_ring(const basic_frame_ring&) = delete;
+    basic_frame_ring& operator=(const basic_frame_ring&) = delete;
+
+    size_t capacity() const { return _capacity; }
+
+    // largest frame which can ever be reserved
+    size_t max_frame_size() const { return _capacity / 2 - header_size; }
+
+    // Producer side. Reserves max_size contiguous bytes, false if the ring is too full.
+    inline bool try_reserve(size_t max_size, reservation& r);
+
+    // publishes the first size bytes of the reservation, a size of 0 abandons it. Bytes
+    // written past size are cleared, the single producer continues right after the frame.
+    inline void commit(reservation& r, size_t size);
+
+    // copies a complete frame into the ring
+    bool try_push(const buffer_view frame) {
+        reservation r;
+        if (frame.empty() || !try_reserve(frame.size, r)) { return false; }
+        memcpy(r.data, frame.data, frame.size);
+        commit(r, frame.size);
+        return true;
+    }
+
+    // Consumer side. The oldest committed frame, valid until release().
+    inline bool try_peek(buffer_view& frame);
+
+    // releases the frame returned by try_peek
+    inline void release();
+
+private:
+    static constexpr uint32_t padding_length = 0xffffffffu;
+
+    const std::unique_ptr<frame_ring_control> _owned_control;
+    const std::unique_ptr<uint64_t[]> _owned_words;
+    frame_ring_control& _control;
+    uint8_t* const _data;
+    const size_t _capacity;
+    const size_t _mask;
+
+    static size_t round_capacity(const size_t capacity) {
+        size_t c = 2 * header_size;
+        while (c < capacity && c < max_capacity) { c *= 2; }
+        return c;
+    }
+
+    static size_t stride(const size_t size) { return header_size + ((size + 7) & ~size_t{ 7 }); }
+
+    uint8_t* at(const uint64_t position) const {
+        return _data + (position & _mask);
+    }
+
+    std::atomic<uint64_t>& header(const uint64_t position) const {
+        return *reinterpret_cast<std::atomic<uint64_t>*>(at(position));
+    }
+
+    static uint64_t make_header(const size_t stride, const uint32_t length) {
+        return (static_cast<uint64_t>(stride) << 32) | length;
+    }
+};
+
+using spsc_frame_ring = basic_frame_ring<false>;
+using mpsc_frame_ring = basic_frame_ring<true>;
+
+template<bool MultiProducer>
+bool basic_frame_ring<MultiProducer>::try_reserve(const size_t max_size, reservation& r) {
+    if (max_size == 0 || max_size > max_frame_size()) { return false; }
+
+    const size_t need = stride(max_size);
+    uint64_t head = _control.head.load(std::memory_order_relaxed);
+    for (;;) {
+        // frames never wrap, the tail end of the ring is skipped instead
+        const size_t offset = static_cast<size_t>(head & _mask);
+        const size_t padding = offset + need > _capacity ? _capacity - offset : 0;
+        const uint64_t tail = _control.tail.load(std::memory_order_acquire);
+        if (head + padding + need - tail > _capacity) { return false; }
+
+        r.position = head + padding;
+        r.data = at(r.position) + header_size;
+        r.capacity = max_size;
+        r.padding = padding;
+
+        if (!MultiProducer) { return true; }
+        // the slot is claimed at its full size, it cannot shrink once other producers follow
+        if (_control.head.compare_exchange_weak(head, r.position + need, std::memory_order_relaxed)) {
+            if (padding != 0) {
+                header(head).store(make_header(padding, padding_length), std::memory_order_release);
+            }
+            return true;
+        }
+    }
+}
+
+template<bool MultiProducer>
+void basic_frame_ring<MultiProducer>::commit(reservation& r, const size_t size) {
+    const size_t frame_size = size <= r.capacity ? size : 0;
+    if (MultiProducer) {
+        header(r.position).store(make_header(stride(r.capacity), static_cast<uint32_t>(frame_size)),
+                                 std::memory_order_release);
+    } else {
+        // the single producer only advances past the bytes used, abandoned slots may be dirty throughout
+        const size_t s = stride(frame_size == 0 ? r.capacity : frame_size);
+        const size_t reserved = stride(r.capacity);
+        if (s < reserved) { memset(at(r.position) + s, 0, reserved - s); }
+        header(r.position).store(make_header(s, static_cast<uint32_t>(frame_size)), std::memory_order_release);
+        if (r.padding != 0) {
+            header(r.position - r.padding).store(make_header(r.padding, padding_length), std::memory_order_release);
+        }
+        _control.head.store(r.position + s, std::memory_order_relaxed);
+    }
+    r = reservation{};
+}
+
+template<bool MultiProducer>
+bool basic_frame_ring<MultiProducer>::try_peek(buffer_view& frame) {
+    for (;;) {
+        const uint64_t tail = _control.tail.load(std::memory_order_relaxed);
+        const uint64_t h = header(tail).load(std::memory_order_acquire);
+        if (h == 0) { return false; }
+
+        const uint32_t length = static_cast<uint32_t>(h);
+        if (length == padding_length || length == 0) {
+            // skips padding and abandoned reservations
+            release();
+            continue;
+        }
+        frame = buffer_view{ at(tail) + header_size, length };
+        return true;
+    }
+}
+
+template<bool MultiProducer>
+void basic_frame_ring<MultiProducer>::release() {
+    const uint64_t tail = _control.tail.load(std::memory_order_relaxed);
+    const size_t s = static_cast<size_t>(header(tail).load(std::memory_order_relaxed) >> 32);
+    memset(at(tail), 0, s);
+    _control.tail.store(tail + s, std::memory_order_release);
+}
+
+template<typename Tracer = null_tracer> struct ring_packer_traits : default_packer_traits {
+    using tracer = Tracer;
+    using buffer_type = span_buffer;
+};
+
+// Packs a single frame straight into a slot reserved in the ring.
+template<typename Ring, typename Traits = ring_packer_traits<>> class ring_packer : public basic_packer<Traits> {
+public:
+    ring_packer(Ring& ring, typename Ring::reservation r)
+            : basic_packer<Traits>(span_buffer{ r.data, r.capacity }), _ring(ring), _reservation(r) {}
+
+    ring_packer(ring_packer&& other) noexcept
+            : basic_packer<Traits>(std::move(other)), _ring(other._ring), _reservation(other._reservation) {
+        other._reservation = typename Ring::reservation{};
+    }
+
+    ring_packer(const ring_packer&) = delete;
+    ring_packer& operator=(const ring_packer&) = delete;
+
+    // uncommitted frames are abandoned
+    ~ring_packer() {
+        if (_reservation.data != nullptr) { _ring.commit(_reservation, 0); }
+    }
+
+    // publishes the frame, false and abandoned if it outgrew the reservation
+    bool commit() {
+        if (_reservation.data == nullptr) { return false; }
+        const bool fits = !this->buffer().spilled();
+        _ring.commit(_reservation, fits ? this->buffer().size() : 0);
+        return fits;
+    }
+
+private:
+    Ring& _ring;
+    typename Ring::reservation _reservation;
+};
+
+}
+
+#endif //MSGPACK_RING_H
@@ -0,0 +1,321 @@
+#ifndef MSGPACK_SCAN_H
+#define MSGPACK_SCAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "buffer.h"
+#include "platform.h"
+#include "types.h"
+#include "unpacker.h"
+
+//*****************************************************************************
+// Projection and predicate pushdown over a stream of records encoded as maps.
+// Predicates compare scalar fields with constants on their raw bytes, a record
+// is abandoned and skipped as soon as one fails. Keys match on their contents,
+// whatever the width of their string header. Matching records are handed out
+// as views of the selected values, everything else is only skipped.
+//
+//   msgpack::scan s;
+//   s.select("path").select("latency").where("status", msgpack::CMP_EQ, 500);
+//   s.run(u, [](const std::vector<msgpack::buffer_view>& row) { ... });
+//*****************************************************************************
+
+namespace msgpack {
+
+enum compare_t : uint8_t {
+    CMP_EQ,
+    CMP_NE,
+    CMP_LT,
+    CMP_LE,
+    CMP_GT,
+    CMP_GE,
+};
+
+template<typename Unpacker = unpacker> class basic_scan : public types {
+public:
+    using unpacker_type = Unpacker;
+
+    // appends a column to the rows handed out, absent values are empty views
+    basic_scan& select(const std::string& key) {
+        _columns.push_back(slot(key));
+        return *this;
+    }
+
+    // Records match if every predicate holds. Integers compare exactly with integers, against
+    // floating point both are compared as doubles, strings compare bytewise. Absent fields and
+    // values of other types never match.
+    template<typename T> typename std::enable_if<std::is_integral<T>::value, basic_scan&>::type
+    where(const std::string& key, const compare_t op, const T value) {
+        scalar c;
+        if (std::is_signed<T>::value && static_cast<int64_t>(value) < 0) {
+            c.kind = scalar::INT;
+            c.i = static_cast<int64_t>(value);
+        } else {
+            c.kind = scalar::UINT;
+            c.u = static_cast<uint64_t>(value);
+        }
+        return add(key, op, c);
+    }
+
+    template<typename T> typename std::enable_if<std::is_floating_point<T>::value, basic_scan&>::type
+    where(const std::string& key, const compare_t op, const T value) {
+        scalar c;
+        c.kind = scalar::REAL;
+        c.d = static_cast<double>(value);
+        return add(key, op, c);
+    }
+
+    basic_scan& where(const std::string& key, const compare_t op, const std::string& value) {
+        _strings.push_back(value);
+        scalar c;
+        c.kind = scalar::STR;
+        return add(key, op, c, _strings.size() - 1);
+    }
+
+    basic_scan& where(const std::string& key, const compare_t op, const char* value) {
+        return where(key, op, std::string{ value });
+    }
+
+    // Scans records until u is empty, passing the selected values of every match to
+    // f(const std::vector<buffer_view>&); the views point into the buffer of u.
+    template<typename F> inline error_code_t run(unpacker_type& u, F f);
+
+    // records scanned and matched by run() so far
+    size_t scanned() const { return _scanned; }
+    size_t matched() const { return _matched; }
+
+private:
+    // a scalar read from raw bytes, non-negative integers are UINT
+    struct scalar {
+        enum kind_t : uint8_t { NONE, INT, UINT, REAL, STR } kind = NONE;
+        int64_t i = 0;
+        uint64_t u = 0;
+        double d = 0;
+        const uint8_t* s = nullptr;
+        size_t len = 0;
+    };
+
+    struct predicate {
+        size_t slot;
+        compare_t op;
+        scalar value;
+        // index of a string constant
+        size_t string;
+    };
+
+    // a key of interest and its value in the current record
+    struct key_slot {
+        std::string key;
+        buffer_view value;
+        bool seen;
+    };
+
+    std::vector<key_slot> _slots;
+    std::vector<size_t> _columns;
+    std::vector<predicate> _predicates;
+    std::vector<std::string> _strings;
+    std::vector<buffer_view> _row;
+    size_t _scanned = 0;
+    size_t _matched = 0;
+
+    size_t slot(const std::string& key) {
+        for (size_t i = 0; i < _slots.size(); ++i) {
+            if (_slots[i].key == key) { return i; }
+        }
+        _slots.push_back(key_slot{ key, buffer_view{}, false });
+        return _slots.size() - 1;
+    }
+
+    basic_scan& add(const std::string& key, const compare_t op, const scalar value, const size_t string = 0) {
+        _predicates.push_back(predicate{ slot(key), op, value, string });
+        return *this;
+    }
+
+    inline static scalar read(buffer_view v);
+    inline bool holds(const predicate& p, buffer_view v) const;
+    inline error_code_t record(unpacker_type& u, bool& match);
+};
+
+using scan = basic_scan<>;
+
+template<typename Unpacker> template<typename F> error_code_t basic_scan<Unpacker>::run(unpacker_type& u, F f) {
+    while (!u.empty()) {
+        bool match;
+        MSGPACK_TRY(record(u, match));
+        ++_scanned;
+        if (!match) { continue; }
+
+        ++_matched;
+        _row.clear();
+        for (const size_t c : _columns) {
+            _row.push_back(_slots[c].seen ? _slots[c].value : buffer_view{});
+        }
+        f(static_cast<const std::vector<buffer_view>&>(_row));
+    }
+    return E_OK;
+}
+
+// reads one record, a failed predicate skips its remaining entries without looking at keys
+template<typename Unpacker> error_code_t basic_scan<Unpacker>::record(unpacker_type& u, bool& match) {
+    size_t entries;
+    MSGPACK_TRY(u.try_map_header(entries));
+    for (key_slot& s : _slots) { s.seen = false; }
+
+    match = true;
+    for (size_t i = 0; i < entries; ++i) {
+        if (!match) {
+            MSGPACK_TRY(u.try_skip());
+            MSGPACK_TRY(u.try_skip());
+            continue;
+        }
+
+        buffer_view key;
+        MSGPACK_TRY(u.try_get(key));
+        buffer_view contents;
+        key_slot* s = nullptr;
+        if (string_contents(key, contents)) {
+            for (key_slot& k : _slots) {
+                if (!k.seen && k.key.size() == contents.size && memcmp(k.key.data(), contents.data, contents.size) == 0) {
+                    s = &k;
+                    break;
+                }
+            }
+        }
+        buffer_view value;
+        MSGPACK_TRY(u.try_get(value));
+        if (s == nullptr) { continue; }
+
+        s->seen = true;
+        s->value = value;
+        const size_t index = static_cast<size_t>(s - _slots.data());
+        for (const predicate& p : _predicates) {
+            if (p.slot == index && !holds(p, value)) { match = false; }
+        }
+    }
+
+    // predicates on absent fields
+    for (const predicate& p : _predicates) {
+        if (!_slots[p.slot].seen) { match = false; }
+    }
+    return E_OK;
+}
+
+template<typename Unpacker> typename basic_scan<Unpacker>::scalar basic_scan<Unpacker>::read(const buffer_view v) {
+    scalar r;
+    const uint8_t* p = v.data;
+    const descriptor& d = describe(*p);
+    switch (d.storage) {
+        case SFIXINT:
+            r.kind = scalar::UINT;
+            r.u = d.value;
+            break;
+        case SFIXNINT:
+            r.kind = scalar::INT;
+            r.i = static_cast<int8_t>(*p);
+            break;
+        case SUINT8:
+            r.kind = scalar::UINT;
+            r.u = p[1];
+            break;
+        case SUINT16:
+            r.kind = scalar::UINT;
+            r.u = platform::load_be<uint16_t>(p + 1);
+            break;
+        case SUINT32:
+            r.kind = scalar::UINT;
+            r.u = platform::load_be<uint32_t>(p + 1);
+            break;
+        case SUINT64:
+            r.kind = scalar::UINT;
+            r.u = platform::load_be<uint64_t>(p + 1);
+            break;
+        case SINT8:
+            r.i = static_cast<int8_t>(p[1]);
+            break;
+        case SINT16:
+            r.i = platform::load_be<int16_t>(p + 1);
+            break;
+        case SINT32:
+            r.i = platform::load_be<int32_t>(p + 1);
+            break;
+        case SINT64:
+            r.i = platform::load_be<int64_t>(p + 1);
+            break;
+        case SFLT32:
+            r.kind = scalar::REAL;
+            r.d = platform::load_be<float>(p + 1);
+            break;
+        case SFLT64:
+            r.kind = scalar::REAL;
+            r.d = platform::load_be<double>(p + 1);
+            break;
+        case SFIXSTR:
+        case SSTR8:
+        case SSTR16:
+        case SSTR32:
+            r.kind = scalar::STR;
+            r.s = p + 1 + d.length;
+            r.len = v.size - 1 - d.length;
+            break;
+        default:
+            break;
+    }
+
+    // signed storage holding a non-negative value
+    if (d.type >= T_INT8 && d.type <= T_INT64 && d.storage != SFIXINT && d.storage != SFIXNINT) {
+        r.kind = r.i < 0 ? scalar::INT : scalar::UINT;
+        r.u = static_cast<uint64_t>(r.i);
+    }
+    return r;
+}
+
+template<typename Unpacker> bool basic_scan<Unpacker>::holds(const predicate& p, const buffer_view v) const {
+    const scalar f = read(v);
+    const scalar& c = p.value;
+
+    int order;
+    if (f.kind == scalar::STR && c.kind == scalar::STR) {
+        const std::string& s = _strings[p.string];
+        const int m = memcmp(f.s, s.data(), f.len < s.size() ? f.len : s.size());
+        order = m != 0 ? m : (f.len < s.size() ? -1 : f.len > s.size() ? 1 : 0);
+    } else if (f.kind == scalar::NONE || f.kind == scalar::STR || c.kind == scalar::STR) {
+        return false;
+    } else if (f.kind == scalar::REAL || c.kind == scalar::REAL) {
+        const double a = f.kind == scalar::REAL ? f.d : f.kind == scalar::INT ? static_cast<double>(f.i)
+                                                                              : static_cast<double>(f.u);
+        const double b = c.kind == scalar::REAL ? c.d : c.kind == scalar::INT ? static_cast<double>(c.i)
+                                                                              : static_cast<double>(c.u);
+        // NaN compares unordered and matches nothing but CMP_NE
+        if (a != a || b != b) { return p.op == CMP_NE; }
+        order = a < b ? -1 : a > b ? 1 : 0;
+    } else if (f.kind != c.kind) {
+        order = f.kind == scalar::INT ? -1 : 1;
+    } else if (f.kind == scalar::INT) {
+        order = f.i < c.i ? -1 : f.i > c.i ? 1 : 0;
+    } else {
+        order = f.u < c.u ? -1 : f.u > c.u ? 1 : 0;
+    }
+
+    switch (p.op) {
+        case CMP_EQ:
+            return order == 0;
+        case CMP_NE:
+            return order != 0;
+        case CMP_LT:
+            return order < 0;
+        case CMP_LE:
+            return order <= 0;
+        case CMP_GT:
+            return order > 0;
+        default:
+            return order >= 0;
+    }
+}
+
+}
+
+#endif //MSGPACK_SCAN_H
@@ -0,0 +1,242 @@
+#ifndef MSGPACK_SHM_CHANNEL_H
+#define MSGPACK_SHM_CHANNEL_H
+
+#if defined(__linux__)
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "ring.h"
+
+//*****************************************************************************
+// Frame ring in shared memory (memfd or POSIX shm) for passing messages
+// between co-located processes. Producers pack in place and commit, the
+// consumer reads frames in place. Producers wake a sleeping consumer through
+// a futex, a busy consumer costs no system call. System call failures are
+// returned as errno values. A named channel is unlinked when its creator
+// closes it, processes that opened it keep their mapping.
+//*****************************************************************************
+
+namespace msgpack {
+
+template<bool MultiProducer> class basic_shm_channel {
+public:
+    using ring_type = basic_frame_ring<MultiProducer>;
+    using reservation = typename ring_type::reservation;
+
+    basic_shm_channel() = default;
+
+    basic_shm_channel(const basic_shm_channel&) = delete;
+    basic_shm_channel& operator=(const basic_shm_channel&) = delete;
+
+    ~basic_shm_channel() { close(); }
+
+    // creates an anonymous channel, its fd() is inherited by fork or passed with SCM_RIGHTS
+    int create(const size_t capacity) {
+        const int fd = static_cast<int>(::syscall(SYS_memfd_create, "msgpack", 0u));
+        if (fd < 0) { return errno; }
+        return init(fd, capacity);
+    }
+
+    // creates a named channel, failing if the name exists; the name is removed again by close()
+    int create(const char* name, const size_t capacity) {
+        const int fd = ::shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) { return errno; }
+        const int e = init(fd, capacity);
+        if (e != 0) {
+            ::shm_unlink(name);
+            return e;
+        }
+        _name = name;
+        return 0;
+    }
+
+    // removes a name left behind, e.g. by a creator that crashed
+    static int remove(const char* name) {
+        return ::shm_unlink(name) == 0 ? 0 : errno;
+    }
+
+    // maps a channel created by another process, takes ownership of fd
+    int open(const int fd) {
+        close();
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            const int e = errno;
+            ::close(fd);
+            return e;
+        }
+        return map(fd, static_cast<size_t>(st.st_size), false);
+    }
+
+    int open(const char* name) {
+        const int fd = ::shm_open(name, O_RDWR, 0);
+        if (fd < 0) { return errno; }
+        return open(fd);
+    }
+
+    void close() {
+        _ring.reset();
+        if (_memory != nullptr) { ::munmap(_memory, _size); }
+        if (_fd >= 0) { ::close(_fd); }
+        if (!_name.empty()) { ::shm_unlink(_name.c_str()); }
+        _name.clear();
+        _memory = nullptr;
+        _size = 0;
+        _fd = -1;
+    }
+
+    bool is_open() const { return _ring != nullptr; }
+    int fd() const { return _fd; }
+    ring_type& ring() { return *_ring; }
+
+    // Producer side, see basic_frame_ring. Committed frames become visible right away,
+    // notify() wakes a waiting consumer and is called once per batch.
+    bool try_reserve(const size_t max_size, reservation& r) { return _ring->try_reserve(max_size, r); }
+    void commit(reservation& r, const size_t size) { _ring->commit(r, size); }
+    bool try_push(const buffer_view frame) { return _ring->try_push(frame); }
+
+    void notify() {
+        _header->sequence.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_header->waiting.load(std::memory_order_relaxed) != 0) {
+            futex(FUTEX_WAKE, 1, nullptr);
+        }
+    }
+
+    // Consumer side, see basic_frame_ring.
+    bool try_peek(buffer_view& frame) { return _ring->try_peek(frame); }
+    void release() { _ring->release(); }
+
+    // Blocks until a frame is available, false on timeout; a negative timeout waits forever.
+    // Spurious wakeups only wait for the rest of the timeout.
+    bool wait(const int timeout_ms = -1) {
+        buffer_view frame;
+        timespec deadline{ 0, 0 };
+        if (timeout_ms >= 0) {
+            ::clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += timeout_ms / 1000;
+            deadline.tv_nsec += static_cast<long>(timeout_ms % 1000) * 1000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                ++deadline.tv_sec;
+                deadline.tv_nsec -= 1000000000;
+            }
+        }
+        for (;;) {
+            const uint32_t sequence = _header->sequence.load(std::memory_order_relaxed);
+            _header->waiting.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (_ring->try_peek(frame)) {
+                _header->waiting.store(0, std::memory_order_relaxed);
+                return true;
+            }
+            // FUTEX_WAIT takes a relative timeout, measured on the monotonic clock
+            timespec rest{ 0, 0 };
+            if (timeout_ms >= 0) {
+                timespec now;
+                ::clock_gettime(CLOCK_MONOTONIC, &now);
+                rest.tv_sec = deadline.tv_sec - now.tv_sec;
+                rest.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+                if (rest.tv_nsec < 0) {
+                    --rest.tv_sec;
+                    rest.tv_nsec += 1000000000;
+                }
+                if (rest.tv_sec < 0) {
+                    _header->waiting.store(0, std::memory_order_relaxed);
+                    return _ring->try_peek(frame);
+                }
+            }
+            const long r = futex(FUTEX_WAIT, sequence, timeout_ms < 0 ? nullptr : &rest);
+            _header->waiting.store(0, std::memory_order_relaxed);
+            if (r != 0 && errno == ETIMEDOUT) { return _ring->try_peek(frame); }
+        }
+    }
+
+private:
+    static constexpr uint64_t magic = 0x6d73677061636b31ull;  // "msgpack1"
+
+    struct shared_header {
+        uint64_t magic;
+        uint64_t capacity;
+        // futex word, bumped by every notify()
+        alignas(64) std::atomic<uint32_t> sequence;
+        std::atomic<uint32_t> waiting;
+        frame_ring_control control;
+    };
+
+    static constexpr size_t data_offset = (sizeof(shared_header) + 63) & ~size_t{ 63 };
+
+    std::unique_ptr<ring_type> _ring;
+    shared_header* _header = nullptr;
+    void* _memory = nullptr;
+    size_t _size = 0;
+    int _fd = -1;
+    // set by the creator of a named channel
+    std::string _name;
+
+    int init(const int fd, const size_t capacity) {
+        close();
+        if (!ring_type::valid_capacity(capacity)) {
+            ::close(fd);
+            return EINVAL;
+        }
+        const size_t size = data_offset + capacity;
+        if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            const int e = errno;
+            ::close(fd);
+            return e;
+        }
+        return map(fd, size, true);
+    }
+
+    int map(const int fd, const size_t size, const bool initialize) {
+        void* memory = size > data_offset ? ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                                          : MAP_FAILED;
+        if (memory == MAP_FAILED) {
+            const int e = size > data_offset ? errno : EINVAL;
+            ::close(fd);
+            return e;
+        }
+        _memory = memory;
+        _size = size;
+        _fd = fd;
+
+        // ftruncate zero fills, the atomics are constructed over the zeroed bytes
+        shared_header* header = static_cast<shared_header*>(memory);
+        const size_t capacity = size - data_offset;
+        if (initialize) {
+            header = new (memory) shared_header{};
+            header->magic = magic;
+            header->capacity = capacity;
+        } else if (header->magic != magic || header->capacity != capacity || !ring_type::valid_capacity(capacity)) {
+            close();
+            return EINVAL;
+        }
+
+        _header = header;
+        _ring.reset(new ring_type{ header->control, static_cast<uint8_t*>(memory) + data_offset, capacity });
+        return 0;
+    }
+
+    long futex(const int op, const uint32_t value, const timespec* timeout) {
+        return ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_header->sequence), op, value, timeout, nullptr, 0);
+    }
+};
+
+using spsc_shm_channel = basic_shm_channel<false>;
+using mpsc_shm_channel = basic_shm_channel<true>;
+
+}
+
+#endif
+
+#endif //MSGPACK_SHM_CHANNEL_H
@@ -0,0 +1,119 @@
+#ifndef MSGPACK_SINK_H
+#define MSGPACK_SINK_H
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+//*****************************************************************************
+// Sinks of streaming packers, see basic_packer::sink(). Both write to a file
+// descriptor owned by the caller and return errno values on failure.
+//*****************************************************************************
+
+namespace msgpack {
+
+// writes to a blocking fd
+struct fd_sink {
+    int fd;
+
+    int operator()(const uint8_t* data, size_t size) const {
+        while (size != 0) {
+            const ssize_t n = ::write(fd, data, size);
+            if (n < 0) {
+                if (errno == EINTR) { continue; }
+                return errno;
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        return 0;
+    }
+};
+
+// Copies into a regular file through a window mapped at its end, growing the file one
+// window at a time. It is stateful, pass it to the packer as std::ref(sink), and close()
+// it afterwards to trim the file to the bytes written.
+class mapped_file_sink {
+public:
+    static constexpr size_t default_window_size = 64 * 1024 * 1024;
+
+    // the window size has to be a multiple of the page size
+    explicit mapped_file_sink(int fd, size_t window_size = default_window_size)
+            : _fd(fd), _window_size(window_size) {}
+
+    mapped_file_sink(const mapped_file_sink&) = delete;
+    mapped_file_sink& operator=(const mapped_file_sink&) = delete;
+
+    ~mapped_file_sink() { close(); }
+
+    int operator()(const uint8_t* data, size_t size) {
+        while (size != 0) {
+            if (_used == _mapped) {
+                const int e = map_next();
+                if (e != 0) { return e; }
+            }
+            const size_t n = std::min(size, _mapped - _used);
+            memcpy(_window + _used, data, n);
+            _used += n;
+            data += n;
+            size -= n;
+        }
+        return 0;
+    }
+
+    // bytes written so far
+    size_t size() const { return _offset + _used; }
+
+    // unmaps the window and truncates the file to size()
+    int close() {
+        if (_window != nullptr) {
+            ::munmap(_window, _mapped);
+            _window = nullptr;
+        }
+        if (!_grown) { return 0; }
+        _grown = false;
+        if (::ftruncate(_fd, static_cast<off_t>(size())) != 0) { return errno; }
+        return 0;
+    }
+
+private:
+    const int _fd;
+    const size_t _window_size;
+    uint8_t* _window = nullptr;
+    // file offset of the window, its size and the bytes used
+    size_t _offset = 0;
+    size_t _mapped = 0;
+    size_t _used = 0;
+    bool _grown = false;
+
+    int map_next() {
+        if (_window != nullptr) {
+            ::munmap(_window, _mapped);
+            _window = nullptr;
+        }
+        _offset += _used;
+        _mapped = 0;
+        _used = 0;
+
+        _grown = true;
+        if (::ftruncate(_fd, static_cast<off_t>(_offset + _window_size)) != 0) { return errno; }
+        void* window = ::mmap(nullptr, _window_size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, static_cast<off_t>(_offset));
+        if (window == MAP_FAILED) { return errno; }
+        _window = static_cast<uint8_t*>(window);
+        _mapped = _window_size;
+        return 0;
+    }
+};
+
+}
+
+#endif
+
+#endif //MSGPACK_SINK_H
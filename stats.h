@@ -0,0 +1,93 @@
+#ifndef MSGPACK_STATS_H
+#define MSGPACK_STATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+//*****************************************************************************
+// Allocation accounting. Compiled in only when MSGPACK_ENABLE_ALLOC_STATS is
+// defined, otherwise every hook expands to nothing.
+//*****************************************************************************
+
+namespace msgpack {
+
+struct alloc_stats {
+    uint64_t allocations = 0;
+    uint64_t bytes_allocated = 0;
+    uint64_t peak_buffer_size = 0;
+
+    void reset() { *this = alloc_stats{}; }
+
+    alloc_stats& operator+=(const alloc_stats& other) {
+        allocations += other.allocations;
+        bytes_allocated += other.bytes_allocated;
+        peak_buffer_size = std::max(peak_buffer_size, other.peak_buffer_size);
+        return *this;
+    }
+};
+
+namespace stats {
+
+#ifdef MSGPACK_ENABLE_ALLOC_STATS
+constexpr bool enabled() { return true; }
+#else
+constexpr bool enabled() { return false; }
+#endif
+
+// statistics of the calling thread
+inline alloc_stats& local() {
+    static thread_local alloc_stats s;
+    return s;
+}
+
+inline void record_allocation(size_t bytes) {
+    alloc_stats& s = local();
+    ++s.allocations;
+    s.bytes_allocated += bytes;
+}
+
+inline void record_buffer_size(size_t size) {
+    alloc_stats& s = local();
+    if (size > s.peak_buffer_size) { s.peak_buffer_size = size; }
+}
+
+// records a reallocation if the capacity of the container has grown during the guard lifetime
+template<typename C> class growth_guard {
+public:
+    explicit growth_guard(const C& c) : _c(c), _capacity(c.capacity()) {}
+
+    ~growth_guard() {
+        if (_c.capacity() > _capacity) {
+            record_allocation(_c.capacity() * sizeof(typename C::value_type));
+        }
+    }
+
+    growth_guard(const growth_guard&) = delete;
+    growth_guard& operator=(const growth_guard&) = delete;
+
+private:
+    const C& _c;
+    const size_t _capacity;
+};
+
+}
+}
+
+#define MSGPACK_STATS_CONCAT_(_A, _B) _A##_B
+#define MSGPACK_STATS_CONCAT(_A, _B) MSGPACK_STATS_CONCAT_(_A, _B)
+
+#ifdef MSGPACK_ENABLE_ALLOC_STATS
+#   define MSGPACK_STATS_ALLOC(_BYTES) ::msgpack::stats::record_allocation(_BYTES)
+#   define MSGPACK_STATS_BUFFER(_SIZE) ::msgpack::stats::record_buffer_size(_SIZE)
+#   define MSGPACK_STATS_GROWTH(_C) \
+        ::msgpack::stats::growth_guard<typename std::decay<decltype(_C)>::type> \
+            MSGPACK_STATS_CONCAT(_msgpack_growth_guard_, __LINE__) { _C }
+#else
+#   define MSGPACK_STATS_ALLOC(_BYTES) do {} while(0)
+#   define MSGPACK_STATS_BUFFER(_SIZE) do {} while(0)
+#   define MSGPACK_STATS_GROWTH(_C) do {} while(0)
+#endif
+
+#endif //MSGPACK_STATS_H
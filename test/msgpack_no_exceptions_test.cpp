@@ -0,0 +1,58 @@
+#include <packer.h>
+#include <unpacker.h>
+#include <stats.h>
+#include <trace.h>
+#include <ring.h>
+#include <shm_channel.h>
+#include <fd_stream.h>
+#include <mutable_view.h>
+#include <columns.h>
+#include <scan.h>
+#include <sink.h>
+#include <parallel.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+//*****************************************************************************
+// Every header built with -fno-exceptions. Errors are reported through the
+// try_* functions, the throwing operators abort instead.
+//*****************************************************************************
+
+namespace {
+
+int failures = 0;
+
+void expect(const bool condition, const char* what) {
+    if (!condition) {
+        fprintf(stderr, "failed: %s\n", what);
+        ++failures;
+    }
+}
+
+}
+
+int main() {
+    using namespace msgpack;
+
+    packer p;
+    p << 1 << "text" << std::vector<int>{ 1, 2, 3 };
+    p.map("id", 7, "name", "event");
+
+    unpacker u{ p.get_buffer() };
+    expect(to_string(u) == "{1,\"text\",[1,2,3],{\"id\":7,\"name\":\"event\"}}", "to_string");
+
+    int i = 0;
+    std::string s;
+    expect(u.try_get(i) == E_OK && i == 1, "try_get int");
+    expect(u.try_get(i) == E_CONVERSION, "conversion error");
+    expect(u.try_get(s) == E_OK && s == "text", "try_get string");
+
+    std::vector<int> v;
+    parallel_decoder decoder{ 2, 1 };
+    expect(decoder.decode(u, v) == E_OK && v == std::vector<int>{ 1, 2, 3 }, "parallel decode");
+    expect(u.try_skip() == E_OK && u.empty(), "try_skip");
+    expect(u.try_get(i) == E_UNDERFLOW, "underflow");
+
+    return failures == 0 ? 0 : 1;
+}
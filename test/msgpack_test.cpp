@@ -2,6 +2,17 @@
 #include <gmock/gmock.h>
 #include <packer.h>
 #include <unpacker.h>
+#include <stats.h>
+#include <trace.h>
+#include <ring.h>
+#include <shm_channel.h>
+#include <fd_stream.h>
+#include <mutable_view.h>
+#include <columns.h>
+#include <scan.h>
+#include <sink.h>
+#include <parallel.h>
+#include <thread>
 
 using namespace msgpack;
 using namespace std;
@@ -140,6 +151,42 @@ TEST(MSGPACK_PACKER_BASE, msgpack_double) {
 
 }
 
+TEST(MSGPACK_PACKER_BASE, msgpack_compact_floats) {
+    const double nan = numeric_limits<double>::quiet_NaN();
+    // integers beyond 32 bits which float32 holds exactly take its 5 bytes
+    const double values[] = { 1.0, -3.0, 3e9, 0.5, 0.1, -0.0, 1e20, -1e300, nan, numeric_limits<double>::infinity(),
+                              1e10, 1099511627776.0, -1e10, 123456789012.0, -2147483648.0 };
+    const size_t sizes[] = { 1, 1, 5, 5, 9, 5, 9, 9, 5, 5, 5, 5, 5, 9, 5 };
+
+    compact_packer p;
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        const size_t before = p.buffer().size();
+        p << values[i];
+        EXPECT_EQ(p.buffer().size() - before, sizes[i]);
+    }
+    p << 2.0f << 0.25f;
+    const size_t before = p.buffer().size();
+    p << 1e10f;
+    EXPECT_EQ(p.buffer().size() - before, 5u);
+    EXPECT_EQ(p.buffer()[before], 0xcau);
+
+    // doubles widen from every form
+    unpacker u{ p.get_buffer() };
+    for (const double v : values) {
+        const double d = get_value<double>(u);
+        if (v != v) {
+            EXPECT_NE(d, d);
+        } else {
+            EXPECT_EQ(d, v);
+            EXPECT_EQ(signbit(d), signbit(v));
+        }
+    }
+    EXPECT_EQ(get_value<float>(u), 2.0f);
+    EXPECT_EQ(get_value<float>(u), 0.25f);
+    EXPECT_EQ(get_value<float>(u), 1e10f);
+    EXPECT_TRUE(u.empty());
+}
+
 TEST(MSGPACK_PACKER_BASE, msgpack_str_char_ptr) {
     packer p;
     p << "test";
@@ -173,6 +220,84 @@ TEST(MSGPACK_PACKER_BASE, msgpack_str_wstring) {
     EXPECT_TRUE(u.empty());
 }
 
+TEST(MSGPACK_PACKER_BASE, msgpack_str_utf16_utf32) {
+    const u16string s16 = u"long enough ascii prefix, \u00fcberpr\u00fcfen \u6f22\u5b57 \U0001F600 and an ascii tail";
+    const u32string s32 = U"long enough ascii prefix, \u00fcberpr\u00fcfen \u6f22\u5b57 \U0001F600 and an ascii tail";
+
+    packer p;
+    p << s16 << s32;
+    EXPECT_EQ(p.get_buffer()[0], p.get_buffer()[p.get_buffer().size() / 2]);
+
+    unpacker u{ p.get_buffer() };
+    EXPECT_EQ(get_value<u32string>(u), s32);
+    EXPECT_EQ(get_value<u16string>(u), s16);
+    EXPECT_TRUE(u.empty());
+}
+
+struct utf8_unpacker_traits : default_unpacker_traits {
+    static constexpr bool validate_utf8 = true;
+};
+
+TEST(MSGPACK_PACKER_BASE, msgpack_str_utf8_validation) {
+    EXPECT_TRUE(utf8::validate("plain ascii, longer than one vector", 35));
+    EXPECT_TRUE(utf8::validate("\xc3\xbc\xe6\xbc\xa2\xf0\x9f\x98\x80", 9));
+    EXPECT_FALSE(utf8::validate("\xc0\xaf", 2));
+    EXPECT_FALSE(utf8::validate("\xed\xa0\x80", 3));
+    EXPECT_FALSE(utf8::validate("\xf4\x90\x80\x80", 4));
+    EXPECT_FALSE(utf8::validate("0123456789abcdef\xe6\xbc", 18));
+
+    packer p;
+    p << "0123456789abcdef\xff";
+
+    unpacker u{ p.get_buffer() };
+    wstring ws;
+    EXPECT_EQ(u.try_get(ws), E_ENCODING);
+    string s;
+    EXPECT_EQ(u.try_get(s), E_OK);
+
+    basic_unpacker<utf8_unpacker_traits> v{ p.get_buffer() };
+    EXPECT_EQ(v.try_get(s), E_ENCODING);
+    EXPECT_THROW(v >> s, output_conversion_error);
+}
+
+TEST(MSGPACK_PACKER_BASE, msgpack_timestamp) {
+    using namespace std::chrono;
+    const system_clock::time_point now = system_clock::now();
+    const timestamp ts32{ 0x12345678, 0 };
+    const timestamp ts64{ (int64_t{ 1 } << 34) - 1, 999999999 };
+    const timestamp ts96{ -1, 500 };
+
+    packer p;
+    p << ts32;
+    EXPECT_EQ(p.get_buffer().size(), 6);
+    p << ts64;
+    EXPECT_EQ(p.get_buffer().size(), 16);
+    p << ts96;
+    EXPECT_EQ(p.get_buffer().size(), 31);
+    p << now << milliseconds{ -1500 };
+
+    unpacker u{ p.get_buffer() };
+    timestamp ts;
+    u >> ts;
+    EXPECT_EQ(ts.seconds, ts32.seconds);
+    EXPECT_EQ(ts.nanoseconds, ts32.nanoseconds);
+    u >> ts;
+    EXPECT_EQ(ts.seconds, ts64.seconds);
+    EXPECT_EQ(ts.nanoseconds, ts64.nanoseconds);
+    u >> ts;
+    EXPECT_EQ(ts.seconds, ts96.seconds);
+    EXPECT_EQ(ts.nanoseconds, ts96.nanoseconds);
+    EXPECT_EQ(get_value<system_clock::time_point>(u), now);
+    EXPECT_EQ(get_value<milliseconds>(u), milliseconds{ -1500 });
+    EXPECT_TRUE(u.empty());
+
+    // fixext 4 of another extension type
+    unpacker v{ vector<uint8_t>{ 0xd6, 0x01, 0x00, 0x00, 0x00, 0x00 }};
+    EXPECT_EQ(v.try_get(ts), E_CONVERSION);
+    v.skip();
+    EXPECT_TRUE(v.empty());
+}
+
 TEST(MSGPACK_PACKER_BASE, msgpack_array) {
     packer p;
     vector<int8_t> v_in{ 1, 2, 3, 4, -5 };
@@ -227,6 +352,22 @@ TEST(MSGPACK_PACKER_BASE, msgpack_map) {
     } while(0)
 
 
+TEST(MSGPACK_PACKER_BASE, msgpack_descriptors) {
+    for (int b = 0; b < 256; ++b) {
+        const types::descriptor& d = types::describe(static_cast<uint8_t>(b));
+        EXPECT_EQ(d.type, types::data_type(d.storage)) << b;
+    }
+    EXPECT_EQ(types::describe(0x7f).value, 0x7f);
+    EXPECT_EQ(types::describe(0x9a).value, 10);
+    EXPECT_EQ(types::describe(0xbf).value, 31);
+    EXPECT_EQ(types::describe(0xc1).storage, types::SUNUSED);
+    EXPECT_EQ(types::describe(0xc8).length, 2);
+    EXPECT_EQ(types::describe(0xc8).payload, 1);
+    EXPECT_EQ(types::describe(0xd8).payload, 17);
+    EXPECT_EQ(types::describe(0xdf).length, 4);
+    EXPECT_EQ(types::describe(0xe0).storage, types::SFIXNINT);
+}
+
 TEST(MSGPACK_PACKER_BASE, msgpack_unpack_skip) {
     TEST_SKIP(true);
     TEST_SKIP(int8_t(1));
@@ -255,6 +396,9 @@ TEST(MSGPACK_PACKER_BASE, msgpack_unpack_skip) {
     std::wstring ws{L"überprüfen"};
     TEST_SKIP(ws);
 
+    TEST_SKIP(chrono::seconds{ 1 });
+    TEST_SKIP(chrono::nanoseconds{ 1 });
+    TEST_SKIP(chrono::seconds{ -1 });
 }
 
 TEST(MSGPACK_PACKER_BASE, msgpack_unpack_unpacker_simple) {
@@ -298,6 +442,681 @@ TEST(MSGPACK_PACKER_BASE, msgpack_pack_packer_array) {
 }
 
 
+struct record {
+    int64_t id = 0;
+    string name;
+    double value = 0;
+    vector<int> tags;
+
+    MSGPACK_FIELDS_BEGIN
+        MSGPACK_FIELD(id)
+        MSGPACK_FIELD(name)
+        MSGPACK_FIELD(value)
+        MSGPACK_FIELD_NAMED(tags, "t")
+    MSGPACK_FIELDS_END
+};
+
+TEST(MSGPACK_PACKER_BASE, msgpack_borrowed_views) {
+    packer p;
+    p << vector<string>{ "a", "b" } << 7;
+
+    unpacker u{ p.get_buffer() };
+    buffer_view array;
+    u >> array;
+    EXPECT_EQ(array.size, 5u);
+    EXPECT_EQ(get_value<int>(u), 7);
+
+    vector<buffer_view> elements;
+    unpacker a = u.borrow(array);
+    a >> elements;
+    ASSERT_EQ(elements.size(), 2u);
+    unpacker b = a.borrow(elements[1]);
+    EXPECT_EQ(get_value<string>(b), "b");
+    EXPECT_TRUE(b.empty());
+
+    // unchecked unpackers borrow views of their validated buffer
+    unchecked_unpacker c{ validate(p.get_buffer()) };
+    c >> array;
+    unchecked_unpacker d = c.borrow(array);
+    EXPECT_EQ(d.get_value<vector<string>>(), (vector<string>{ "a", "b" }));
+}
+
+TEST(MSGPACK_PACKER_BASE, msgpack_columns) {
+    packer rows;
+    rows.begin_array();
+    rows.map("id", 1, "name", "a", "ok", true);
+    rows.map("name", "b", "id", 2, "extra", vector<int>{ 1, 2 });
+    rows.map("id", 3, "id", 4, "ok", false);
+    rows.end_array();
+
+    vector<int64_t> ids;
+    vector<string> names;
+    vector<bool> oks;
+    column_set columns;
+    columns.column("id", ids).column("name", names).column("ok", oks);
+
+    unpacker u{ rows.get_buffer() };
+    ASSERT_EQ(columns.decode(u), E_OK);
+    EXPECT_TRUE(u.empty());
+    EXPECT_EQ(columns.rows(), 3u);
+    EXPECT_EQ(ids, (vector<int64_t>{ 1, 2, 3 }));
+    EXPECT_EQ(names, (vector<string>{ "a", "b", "" }));
+    EXPECT_EQ(oks, (vector<bool>{ true, false, false }));
+
+    // round trip through the row encoding
+    packer encoded;
+    columns.encode(encoded);
+    vector<int64_t> ids2;
+    vector<string> names2;
+    vector<bool> oks2;
+    column_set decoded;
+    decoded.column("ok", oks2).column("name", names2).column("id", ids2);
+    unpacker v{ encoded.get_buffer() };
+    ASSERT_EQ(decoded.decode(v), E_OK);
+    EXPECT_EQ(ids2, ids);
+    EXPECT_EQ(names2, names);
+    EXPECT_EQ(oks2, oks);
+    EXPECT_EQ(encoded.get_buffer()[0], 0x93u);
+    EXPECT_EQ(encoded.get_buffer()[1], 0x83u);
+
+    // the encoded rows count as one value of an enclosing scope
+    packer outer;
+    outer.begin_array();
+    columns.encode(outer);
+    outer << 1;
+    outer.end_array();
+    unpacker o{ outer.get_buffer() };
+    size_t len = 0;
+    ASSERT_EQ(o.try_array_header(len), E_OK);
+    EXPECT_EQ(len, 2u);
+    o.skip();
+    int last = 0;
+    o >> last;
+    EXPECT_EQ(last, 1);
+    EXPECT_TRUE(o.empty());
+
+    // keys match on their contents, a str8 header for a short key and non-string keys included
+    const vector<uint8_t> wide{ 0x92, 0x81, 0xd9, 0x02, 'i', 'd', 0x05, 0x82, 0x01, 0x02, 0xda, 0x00, 0x02, 'i', 'd', 0x06 };
+    unpacker x{ wide };
+    ASSERT_EQ(columns.decode(x), E_OK);
+    EXPECT_EQ(ids, (vector<int64_t>{ 1, 2, 3, 5, 6 }));
+    EXPECT_EQ(names.size(), 5u);
+    ids.resize(3);
+    names.resize(3);
+    oks.resize(3);
+
+    // a failing record removes the batch
+    packer bad;
+    bad.array(map<string, int>{{ "id", 5 }}, map<string, string>{{ "id", "x" }});
+    unpacker w{ bad.get_buffer() };
+    EXPECT_EQ(columns.decode(w), E_CONVERSION);
+    EXPECT_EQ(ids.size(), 3u);
+    EXPECT_EQ(names.size(), 3u);
+    EXPECT_EQ(oks.size(), 3u);
+}
+
+TEST(MSGPACK_PACKER_BASE, msgpack_scan) {
+    packer p;
+    p.map("status", 200, "path", "/a", "latency", 0.5, "tags", vector<string>{ "x" });
+    p.map("path", "/b", "status", 500, "latency", 12.5);
+    p.map("status", 500, "latency", 1);
+    p.map("status", -1, "path", "/d", "latency", uint64_t{ 1 } << 63);
+    p.map("status", "500", "path", "/e", "latency", 20);
+
+    auto run = [&p](scan& s) {
+        vector<string> paths;
+        unpacker u{ p.get_buffer() };
+        EXPECT_EQ(s.run(u, [&u, &paths](const vector<buffer_view>& row) {
+            string path;
+            if (!row[0].empty()) { u.borrow(row[0]) >> path; }
+            paths.push_back(path);
+        }), E_OK);
+        EXPECT_EQ(s.scanned(), 5u);
+        return paths;
+    };
+
+    scan errors;
+    errors.select("path").where("status", CMP_EQ, 500);
+    EXPECT_EQ(run(errors), (vector<string>{ "/b", "" }));
+    EXPECT_EQ(errors.matched(), 2u);
+
+    scan slow;
+    slow.select("path").where("latency", CMP_GT, 1).where("status", CMP_NE, 200);
+    EXPECT_EQ(run(slow), (vector<string>{ "/b", "/d" }));
+
+    scan exact;
+    exact.select("path").where("latency", CMP_GE, uint64_t{ 1 } << 63).where("status", CMP_LT, 0);
+    EXPECT_EQ(run(exact), (vector<string>{ "/d" }));
+
+    scan strings;
+    strings.select("path").where("path", CMP_GE, "/b").where("path", CMP_LT, "/e");
+    EXPECT_EQ(run(strings), (vector<string>{ "/b", "/d" }));
+
+    // keys match on their contents, whatever their string header, non-string keys never
+    const vector<uint8_t> wide{ 0x83, 0xd9, 0x06, 's', 't', 'a', 't', 'u', 's', 0xcd, 0x01, 0xf4,
+                                0xda, 0x00, 0x04, 'p', 'a', 't', 'h', 0xa2, '/', 'w', 0x01, 0x02 };
+    scan wide_keys;
+    wide_keys.select("path").where("status", CMP_EQ, 500);
+    unpacker w{ wide };
+    vector<string> paths;
+    EXPECT_EQ(wide_keys.run(w, [&w, &paths](const vector<buffer_view>& row) {
+        string path;
+        w.borrow(row[0]) >> path;
+        paths.push_back(path);
+    }), E_OK);
+    EXPECT_EQ(paths, vector<string>{ "/w" });
+
+    // records have to be maps
+    unpacker u{ vector<uint8_t>{ 0x01 }};
+    EXPECT_EQ(errors.run(u, [](const vector<buffer_view>&) {}), E_CONVERSION);
+}
+
+TEST(MSGPACK_PACKER_BASE, msgpack_fields) {
+    static_assert(has_fields<record, unpacker>::value, "record declares its fields");
+    static_assert(!has_fields<string, unpacker>::value, "string has no fields");
+
+    packer p;
+    p.map("value", 0.5, "unknown", vector<int>{ 1, 2 }, "t", vector<int>{ 3 }, "id", 7, "name", "first");
+    p << vector<map<string, int>>{{{ "id", 1 }}, {{ "id", 2 }, { "other", 3 }}};
+    p.map("id", "not a number");
+
+    unpacker u{ p.get_buffer() };
+    record r;
+    u >> r;
+    EXPECT_EQ(r.id, 7);
+    EXPECT_EQ(r.name, "first");
+    EXPECT_EQ(r.value, 0.5);
+    EXPECT_EQ(r.tags, vector<int>{ 3 });
+
+    vector<record> rs;
+    u >> rs;
+    ASSERT_EQ(rs.size(), 2);
+    EXPECT_EQ(rs[0].id, 1);
+    EXPECT_EQ(rs[1].id, 2);
+
+    EXPECT_EQ(u.try_get(r), E_CONVERSION);
+    EXPECT_THROW(u >> r, output_conversion_error);
+
+    // keys read at run time hash like the case labels, long ones without recursing
+    static_assert(key_hash("name", 4) != key_hash("id", 2), "distinct labels");
+    EXPECT_EQ(runtime_key_hash("name", 4), key_hash("name", 4));
+    EXPECT_EQ(runtime_key_hash("", 0), key_hash("", 0));
+    packer q;
+    q.map(string(8 * 1024 * 1024, 'k'), 1, "id", 8);
+    unpacker v{ q.get_buffer() };
+    v >> r;
+    EXPECT_EQ(r.id, 8);
+}
+
+struct tree_node {
+    string name;
+    vector<tree_node> children;
+
+    MSGPACK_FIELDS_BEGIN
+        MSGPACK_FIELD(name)
+        MSGPACK_FIELD(children)
+    MSGPACK_FIELDS_END
+};
+
+// fields on one line and from a macro of their own
+#define POINT_FIELDS MSGPACK_FIELD(x) MSGPACK_FIELD(y)
+struct point {
+    int x = 0, y = 0, z = 0;
+    MSGPACK_FIELDS_BEGIN POINT_FIELDS MSGPACK_FIELD(z) MSGPACK_FIELDS_END
+};
+
+TEST(MSGPACK_PACKER_BASE, msgpack_shape_cache) {
+    // repeated layouts, then changed order, a differing key of the same length, an extra key
+    packer p;
+    for (int i = 0; i < 3; ++i) { p.map("id", i, "name", "n", "t", vector<int>{ i }); }
+    p.map("name", "reordered", "id", 3, "t", vector<int>{});
+    p.map("ix", 9, "name", "ix", "t", vector<int>{ 4 });
+    p.map("id", 5, "name", "extra", "t", vector<int>{ 5 }, "value", 1.5);
+    p.map("id", 6, "name", "n", "t", vector<int>{ 6 });
+
+    unpacker expected{ p.get_buffer() };
+    basic_unpacker<shape_cache_unpacker_traits> u{ p.get_buffer() };
+    while (!expected.empty()) {
+        record a, b;
+        expected >> a;
+        u >> b;
+        EXPECT_EQ(b.id, a.id);
+        EXPECT_EQ(b.name, a.name);
+        EXPECT_EQ(b.value, a.value);
+        EXPECT_EQ(b.tags, a.tags);
+    }
+    EXPECT_TRUE(u.empty());
+
+    // a key resolves to the id of its member, which decodes it later without a key
+    packer f;
+    f << 11 << 12 << "skipped" << 13;
+    unpacker fu{ f.get_buffer() };
+    record direct;
+    size_t id = 0;
+    size_t unknown = 1;
+    EXPECT_EQ(direct.decode_field(fu, key_hash("id", 2), "id", 2, id), E_OK);
+    EXPECT_EQ(id, 1u);
+    EXPECT_EQ(direct.decode_field(fu, id, nullptr, 0, unknown), E_OK);
+    EXPECT_EQ(direct.id, 12);
+    EXPECT_EQ(direct.decode_field(fu, key_hash("other", 5), "other", 5, unknown), E_OK);
+    EXPECT_EQ(unknown, 0u);
+    EXPECT_EQ(direct.decode_field(fu, id, nullptr, 0, unknown), E_OK);
+    EXPECT_EQ(direct.id, 13);
+
+    // hits on unknown keys skip their values
+    packer s;
+    for (int i = 0; i < 3; ++i) { s.map("other", vector<int>{ i }, "id", 20 + i); }
+    basic_unpacker<shape_cache_unpacker_traits> su{ s.get_buffer() };
+    for (int i = 0; i < 3; ++i) {
+        su >> direct;
+        EXPECT_EQ(direct.id, 20 + i);
+    }
+    EXPECT_TRUE(su.empty());
+
+    // ids follow the field list wherever its macros are expanded
+    packer pts;
+    for (int i = 0; i < 3; ++i) { pts.map("z", i, "y", 10 + i, "x", 20 + i); }
+    basic_unpacker<shape_cache_unpacker_traits> pu{ pts.get_buffer() };
+    for (int i = 0; i < 3; ++i) {
+        point pt;
+        pu >> pt;
+        EXPECT_EQ(pt.x, 20 + i);
+        EXPECT_EQ(pt.y, 10 + i);
+        EXPECT_EQ(pt.z, i);
+    }
+    point pt;
+    packer pv;
+    pv << 7;
+    unpacker pvu{ pv.get_buffer() };
+    size_t z_field = 0;
+    EXPECT_EQ(pt.decode_field(pvu, key_hash("z", 1), "z", 1, z_field), E_OK);
+    EXPECT_EQ(z_field, 3u);
+
+    // nested maps of the same struct share its shape
+    packer q;
+    q.map("name", "root", "children", vector<packer>{
+            packer{}.map("name", "a", "children", vector<int>{}),
+            packer{}.map("children", vector<int>{}, "name", "b") });
+    basic_unpacker<shape_cache_unpacker_traits> v{ q.get_buffer() };
+    tree_node root;
+    v >> root;
+    EXPECT_EQ(root.name, "root");
+    ASSERT_EQ(root.children.size(), 2u);
+    EXPECT_EQ(root.children[0].name, "a");
+    EXPECT_EQ(root.children[1].name, "b");
+
+    // truncated keys of a learned shape are not read past the end
+    packer r;
+    r.map("name", "x", "children", vector<int>{});
+    vector<uint8_t> cut = r.get_buffer();
+    cut.resize(3);
+    basic_unpacker<shape_cache_unpacker_traits> w{ r.get_buffer() };
+    w >> root;
+    basic_unpacker<shape_cache_unpacker_traits> x{ cut };
+    EXPECT_EQ(x.try_get(root), E_UNDERFLOW);
+
+    const uint8_t k1[] = "0123456789abcdefg";
+    const uint8_t k2[] = "0123456789abcdefh";
+    for (size_t n = 0; n <= 17; ++n) { EXPECT_EQ(platform::equal_bytes(k1, k2, n), n < 17); }
+}
+
+// decoded by a user provided operator>> that throws
+struct positive {
+    int value = 0;
+};
+
+unpacker& operator>>(unpacker& u, positive& p) {
+    u >> p.value;
+    if (p.value <= 0) { throw std::domain_error{ "not positive" }; }
+    return u;
+}
+
+TEST(MSGPACK_PACKER_BASE, msgpack_parallel_decode) {
+    packer p;
+    p.begin_array();
+    for (int i = 0; i < 1000; ++i) { p.map("id", i, "name", to_string(i), "t", vector<int>(static_cast<size_t>(i % 7), i)); }
+    p.end_array();
+    map<string, int> entries;
+    for (int i = 0; i < 500; ++i) { entries[to_string(i)] = i; }
+    p << entries << 1;
+
+    // small chunks so every thread gets some, appended after what vec held
+    parallel_decoder decoder{ 4, 16 };
+    unpacker u{ p.get_buffer() };
+    vector<record> rs(1);
+    EXPECT_EQ(decoder.decode(u, rs), E_OK);
+    ASSERT_EQ(rs.size(), 1001u);
+    for (int i = 0; i < 1000; ++i) {
+        const record& r = rs[static_cast<size_t>(i) + 1];
+        EXPECT_EQ(r.id, i);
+        EXPECT_EQ(r.name, to_string(i));
+        EXPECT_EQ(r.tags, vector<int>(static_cast<size_t>(i % 7), i));
+    }
+
+    vector<pair<string, int>> decoded;
+    EXPECT_EQ(decoder.decode(u, decoded), E_OK);
+    EXPECT_EQ(decoded, (vector<pair<string, int>>(entries.begin(), entries.end())));
+    EXPECT_EQ(u.get_value<int>(), 1);
+    EXPECT_TRUE(u.empty());
+
+    // errors leave the output and the read position as they were
+    packer q;
+    q << vector<int>(100, 1);
+    q << vector<string>(100, "s");
+    vector<uint8_t> cut = q.get_buffer();
+    cut.resize(cut.size() - 1);
+    unpacker v{ cut };
+    vector<string> strings{ "kept" };
+    EXPECT_EQ(decoder.decode(v, strings), E_CONVERSION);
+    EXPECT_EQ(strings, vector<string>{ "kept" });
+    v.skip();
+    EXPECT_EQ(decoder.decode(v, strings), E_UNDERFLOW);
+    EXPECT_EQ(strings, vector<string>{ "kept" });
+    EXPECT_EQ(v.type(), types::T_ARRAY);
+
+    // lengths the remaining bytes cannot hold are rejected before sizing the output
+    unpacker forged{ vector<uint8_t>{ 0xdd, 0xff, 0xff, 0xff, 0xff }};
+    EXPECT_EQ(decoder.decode(forged, strings), E_UNDERFLOW);
+    EXPECT_EQ(strings, vector<string>{ "kept" });
+    unpacker forged_map{ vector<uint8_t>{ 0xdf, 0x00, 0x00, 0x00, 0x02, 0x01, 0x02, 0x03 }};
+    EXPECT_EQ(decoder.decode(forged_map, decoded), E_UNDERFLOW);
+    EXPECT_EQ(decoder.for_each<string>(forged, [](size_t, const string&) {}), E_UNDERFLOW);
+
+    packer r;
+    r << vector<string>(99, "s") << vector<int>(64, 2);
+    unpacker w{ r.get_buffer() };
+    std::atomic<size_t> sum{ 0 };
+    const auto add = [&sum](size_t i, const int& value) { sum += i * static_cast<size_t>(value); };
+    EXPECT_EQ(decoder.for_each<int>(w, add), E_CONVERSION);
+    w.skip();
+    EXPECT_EQ(decoder.for_each<int>(w, add), E_OK);
+    EXPECT_EQ(sum.load(), 63u * 64u);
+
+    // exceptions of the threads are rethrown on the caller
+    vector<int> numbers(200, 1);
+    numbers[150] = 0;
+    packer n;
+    n << numbers;
+    unpacker x{ n.get_buffer() };
+    vector<positive> ps;
+    EXPECT_THROW(decoder.decode(x, ps), std::domain_error);
+    EXPECT_TRUE(ps.empty());
+    EXPECT_EQ(x.type(), types::T_ARRAY);
+}
+
+TEST(MSGPACK_PACKER_BASE, msgpack_batch_reuse) {
+    const string long_name(64, 'n');
+    packer p;
+    for (int i = 0; i < 5; ++i) {
+        p.map("id", i, "name", long_name, "t", vector<int>(8, i));
+    }
+
+    basic_unpacker<reuse_unpacker_traits> u{ p.get_buffer() };
+    vector<record> pool(2);
+    EXPECT_EQ(u.get_batch(pool.begin(), pool.end()), 2u);
+    EXPECT_EQ(pool[1].id, 1);
+    const char* name = pool[0].name.data();
+    const int* tags = pool[0].tags.data();
+
+    // later batches decode into the same storage, the last one only partially fills the pool
+    EXPECT_EQ(u.get_batch(pool.begin(), pool.end()), 2u);
+    EXPECT_EQ(pool[0].id, 2);
+    EXPECT_EQ(pool[0].name, long_name);
+    EXPECT_EQ(pool[0].tags, vector<int>(8, 2));
+    EXPECT_EQ(pool[0].name.data(), name);
+    EXPECT_EQ(pool[0].tags.data(), tags);
+    EXPECT_EQ(u.get_batch(pool.begin(), pool.end()), 1u);
+    EXPECT_EQ(pool[0].id, 4);
+    EXPECT_TRUE(u.empty());
+
+    // fields absent from the next message are reset, capacity is kept
+    packer m;
+    m.map("id", 1, "name", long_name, "t", vector<int>{ 1 }, "value", 2.5);
+    m.map("id", 2);
+    basic_unpacker<reuse_unpacker_traits> w{ m.get_buffer() };
+    vector<record> one(1);
+    EXPECT_EQ(w.get_batch(one.begin(), one.end()), 1u);
+    const size_t capacity = one[0].name.capacity();
+    EXPECT_EQ(w.get_batch(one.begin(), one.end()), 1u);
+    EXPECT_EQ(one[0].id, 2);
+    EXPECT_EQ(one[0].name, "");
+    EXPECT_TRUE(one[0].tags.empty());
+    EXPECT_EQ(one[0].value, record{}.value);
+    EXPECT_EQ(one[0].name.capacity(), capacity);
+
+    // shorter arrays drop the surplus elements
+    packer q;
+    q << vector<string>{ "a", "b", "c" } << vector<string>{ "d" };
+    basic_unpacker<reuse_unpacker_traits> v{ q.get_buffer() };
+    vector<string> s;
+    v >> s;
+    v >> s;
+    EXPECT_EQ(s, vector<string>{ "d" });
+}
+
+// counts allocations on a shared counter
+template<typename T> struct counting_allocator {
+    using value_type = T;
+    size_t* count;
+
+    explicit counting_allocator(size_t* c) : count(c) {}
+    template<typename U> counting_allocator(const counting_allocator<U>& other) : count(other.count) {}
+
+    T* allocate(size_t n) {
+        ++*count;
+        return std::allocator<T>{}.allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) { std::allocator<T>{}.deallocate(p, n); }
+};
+
+template<typename T, typename U> bool operator==(const counting_allocator<T>& a, const counting_allocator<U>& b) {
+    return a.count == b.count;
+}
+
+template<typename T, typename U> bool operator!=(const counting_allocator<T>& a, const counting_allocator<U>& b) {
+    return a.count != b.count;
+}
+
+TEST(MSGPACK_PACKER_BASE, msgpack_allocators) {
+    using counted_bytes = vector<uint8_t, counting_allocator<uint8_t>>;
+    using counted_string = basic_string<char, char_traits<char>, counting_allocator<char>>;
+    size_t allocations = 0;
+    const counting_allocator<uint8_t> a{ &allocations };
+
+    basic_packer<allocator_packer_traits<counting_allocator<uint8_t>>> p{ counted_bytes{ a } };
+    p << vector<int>{ 1, 2, 3 } << string(40, 's') << map<string, int>{{ "k", 1 }};
+    EXPECT_GT(allocations, 0u);
+
+    // the copy, its shared state and the decoded containers all come from the allocator
+    size_t before = allocations;
+    basic_unpacker<allocator_unpacker_traits<counting_allocator<uint8_t>>> u{ p.buffer() };
+    EXPECT_EQ(allocations - before, 2u);
+
+    vector<int, counting_allocator<int>> v{ counting_allocator<int>{ &allocations }};
+    counted_string s{ counting_allocator<char>{ &allocations }};
+    map<string, int, less<string>, counting_allocator<pair<const string, int>>> m{
+            less<string>{}, counting_allocator<pair<const string, int>>{ &allocations }};
+    u >> v >> s;
+    EXPECT_EQ(v.size(), 3u);
+    EXPECT_EQ(v[2], 3);
+    EXPECT_EQ(s, string(40, 's').c_str());
+    // one node
+    before = allocations;
+    u >> m;
+    EXPECT_EQ(allocations - before, 1u);
+    EXPECT_EQ(m.at("k"), 1);
+
+    // strings with other allocators pack as strings
+    packer q;
+    q << s;
+    unpacker w{ q.get_buffer() };
+    EXPECT_EQ(get_value<string>(w), string(40, 's'));
+
+    // validated buffers keep the allocator of their buffer as well
+    before = allocations;
+    validated_buffer vb{ counted_bytes{ p.buffer() }};
+    EXPECT_TRUE(vb);
+    EXPECT_EQ(allocations - before, 2u);
+    unchecked_unpacker x{ vb };
+    EXPECT_EQ(x.get_value<vector<int>>(), (vector<int>{ 1, 2, 3 }));
+
+#if MSGPACK_HAS_PMR
+    // nothing reaches the default resource while decoding into an arena
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::memory_resource* previous = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+    pmr_packer r{ std::pmr::vector<uint8_t>{ &arena }};
+    r << vector<string>{ string(40, 'a'), string(50, 'b') };
+    pmr_unpacker y{ r.take_buffer() };
+    std::pmr::vector<std::pmr::string> strings{ &arena };
+    y >> strings;
+    std::pmr::set_default_resource(previous);
+    EXPECT_EQ(strings.size(), 2u);
+    EXPECT_EQ(strings[1], std::pmr::string(50, 'b'));
+    EXPECT_EQ(strings[1].get_allocator().resource(), &arena);
+
+    // keys and values of maps too
+    pmr_packer t{ std::pmr::vector<uint8_t>{ &arena }};
+    t << map<string, string>{{ string(40, 'k'), string(60, 'v') }};
+    pmr_unpacker z{ t.take_buffer() };
+    std::pmr::map<std::pmr::string, std::pmr::string> strings_by_key{ &arena };
+    previous = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+    z >> strings_by_key;
+    std::pmr::set_default_resource(previous);
+    ASSERT_EQ(strings_by_key.size(), 1u);
+    EXPECT_EQ(strings_by_key.begin()->first, std::pmr::string(40, 'k'));
+    EXPECT_EQ(strings_by_key.begin()->second.get_allocator().resource(), &arena);
+#endif
+}
+
+struct recording_visitor : visitor {
+    string events;
+
+    void on_nil() { events += "nil "; }
+    void on_bool(bool b) { events += b ? "true " : "false "; }
+    void on_int(int64_t i) { events += "i" + to_string(i) + ' '; }
+    void on_uint(uint64_t u) { events += "u" + to_string(u) + ' '; }
+    void on_double(double d) { events += "d" + to_string(d) + ' '; }
+    void on_str(const char* data, size_t size) { events += '"' + string(data, size) + "\" "; }
+    void on_ext(int8_t type, const uint8_t*, size_t size) { events += "ext" + to_string(type) + ':' + to_string(size) + ' '; }
+    void begin_array(size_t n) { events += '[' + to_string(n) + ' '; }
+    void end_array() { events += "] "; }
+    void begin_map(size_t n) { events += '{' + to_string(n) + ' '; }
+    void end_map() { events += "} "; }
+};
+
+TEST(MSGPACK_PACKER_BASE, msgpack_visit) {
+    packer p;
+    p.map("a", vector<int>{ 1, -2, 300, -70000 }, "b", nullptr, "c", true, "d", 0.5);
+    p << uint64_t{ 1 } << 40 << chrono::seconds{ 1 };
+
+    recording_visitor v;
+    unpacker u{ p.get_buffer() };
+    while (!u.empty()) { u.visit(v); }
+    EXPECT_EQ(v.events, "{4 \"a\" [4 u1 i-2 i300 i-70000 ] \"b\" nil \"c\" true \"d\" d0.500000 } u1 u40 ext-1:4 ");
+
+    // truncated input is reported and the position restored
+    vector<uint8_t> truncated = p.get_buffer();
+    truncated.resize(5);
+    unpacker t{ truncated };
+    recording_visitor w;
+    EXPECT_EQ(t.try_visit(w), E_UNDERFLOW);
+    EXPECT_EQ(t.try_skip(), E_UNDERFLOW);
+
+    // hostile nesting fails instead of exhausting the stack, the limit is adjustable
+    vector<uint8_t> deep(2000000, 0x91);
+    deep.push_back(0xc0);
+    unpacker n{ deep };
+    visitor quiet;
+    EXPECT_EQ(n.try_visit(quiet), E_DEPTH);
+    EXPECT_THROW(n.visit(quiet), output_conversion_error);
+    unpacker shallow{ vector<uint8_t>{ 0x91, 0x91, 0xc0 }};
+    EXPECT_EQ(shallow.try_visit(quiet, 1), E_DEPTH);
+    EXPECT_EQ(shallow.try_visit(quiet, 2), E_OK);
+}
+
+TEST(MSGPACK_PACKER_BASE, msgpack_try_get) {
+    packer p;
+    p << 300 << "test" << vector<int>{ 1, 2, 3 };
+
+    unpacker u{ p.get_buffer() };
+    int8_t i8;
+    EXPECT_EQ(u.try_get(i8), E_CONVERSION);
+    bool b;
+    EXPECT_EQ(u.try_get(b), E_CONVERSION);
+    int16_t i16;
+    EXPECT_EQ(u.try_get(i16), E_OK);
+    EXPECT_EQ(i16, 300);
+
+    map<int, int> m;
+    EXPECT_EQ(u.try_get(m), E_CONVERSION);
+    string s;
+    EXPECT_EQ(u.try_get(s), E_OK);
+    EXPECT_EQ(s, "test");
+
+    vector<int> v;
+    EXPECT_EQ(u.try_for_each<int>([&v](int i) { v.push_back(i); }), E_OK);
+    EXPECT_THAT(v, ::testing::ElementsAre(1, 2, 3));
+    EXPECT_TRUE(u.empty());
+    EXPECT_EQ(u.try_get(i16), E_UNDERFLOW);
+    EXPECT_EQ(u.try_skip(), E_UNDERFLOW);
+}
+
+TEST(MSGPACK_PACKER_BASE, msgpack_try_get_truncated) {
+    packer p;
+    p << vector<string>{ "first", "second" };
+    vector<uint8_t> buf = p.get_buffer();
+    buf.pop_back();
+
+    unpacker u{ buf };
+    vector<string> v;
+    EXPECT_EQ(u.try_skip(), E_UNDERFLOW);
+    EXPECT_EQ(u.try_get(v), E_UNDERFLOW);
+    EXPECT_EQ(u.type(), unpacker::T_ARRAY);
+    EXPECT_THROW(u >> v, output_underflow_error);
+}
+
+TEST(MSGPACK_PACKER_BASE, msgpack_validated_unchecked) {
+    packer p;
+    p << 1 << (int64_t{ 1 } << 40) << "test" << vector<double>{ 0.5, 1.5 } << map<string, int>{{ "a", 1 }};
+
+    validated_buffer vb = validate(p.get_buffer());
+    ASSERT_EQ(vb.error(), E_OK);
+
+    unchecked_unpacker u{ vb };
+    int32_t i;
+    int64_t l;
+    string s;
+    vector<double> v;
+    map<string, int> m;
+    u >> i >> l >> s >> v >> m;
+
+    EXPECT_EQ(i, 1);
+    EXPECT_EQ(l, int64_t{ 1 } << 40);
+    EXPECT_EQ(s, "test");
+    EXPECT_THAT(v, ::testing::ElementsAre(0.5, 1.5));
+    EXPECT_EQ(m["a"], 1);
+    EXPECT_TRUE(u.empty());
+}
+
+TEST(MSGPACK_PACKER_BASE, msgpack_validate_errors) {
+    packer p;
+    p << vector<string>{ "first", "second" };
+    vector<uint8_t> buf = p.get_buffer();
+
+    EXPECT_EQ(validate(buf).error(), E_OK);
+    EXPECT_EQ(validate(vector<uint8_t>(buf.begin(), buf.end() - 1)).error(), E_UNDERFLOW);
+    EXPECT_EQ(validate(vector<uint8_t>{ 0xc1 }).error(), E_CONVERSION);
+    EXPECT_EQ(validate(vector<uint8_t>{ 0xdd, 0xff, 0xff, 0xff, 0xff }).error(), E_UNDERFLOW);
+
+    vector<uint8_t> nested(100, 0x91);
+    nested.push_back(0x01);
+    EXPECT_EQ(validate(nested).error(), E_DEPTH);
+    EXPECT_EQ(validate(nested, 100).error(), E_OK);
+
+    EXPECT_THROW(unchecked_unpacker{ validate(vector<uint8_t>{ 0xc1 }) }, output_conversion_error);
+}
+
 string test_pack_to_string(packer& p) {
     return to_string(unpacker{ p.get_buffer() });
 }
@@ -312,6 +1131,163 @@ template <typename ... ARGS> string test_pack_to_string(ARGS... args) {
     return test_pack_to_string(p, args...);
 }
 
+struct fixed_packer_traits : default_packer_traits {
+    static constexpr bool fixed_width = true;
+};
+
+struct fixed_compact_packer_traits : fixed_packer_traits {
+    static constexpr bool compact_floats = true;
+};
+
+TEST(MSGPACK_PACKER_BASE, msgpack_fixed_width) {
+    packer p;
+    p << fixed(int32_t{ 1 }) << fixed(uint64_t{ 2 }) << fixed(timestamp{ 1, 0 }) << 3;
+    const vector<uint8_t> expected{ 0xd2, 0, 0, 0, 1,
+                                    0xcf, 0, 0, 0, 0, 0, 0, 0, 2,
+                                    0xd7, 0xff, 0, 0, 0, 0, 0, 0, 0, 1,
+                                    0x03 };
+    EXPECT_EQ(p.get_buffer(), expected);
+
+    basic_packer<fixed_packer_traits> f;
+    f << 1 << int64_t{ -1 } << uint32_t{ 7 };
+    EXPECT_EQ(f.get_buffer().size(), 5u + 9u + 5u);
+
+    unpacker u{ f.get_buffer() };
+    EXPECT_EQ(get_value<int>(u), 1);
+    EXPECT_EQ(get_value<int64_t>(u), -1);
+    EXPECT_EQ(get_value<uint32_t>(u), 7u);
+
+    // doubles keep their width to remain patchable
+    basic_packer<fixed_compact_packer_traits> c;
+    c << 1.0;
+    EXPECT_EQ(c.get_buffer().size(), 9u);
+}
+
+// packed by a user provided operator<< through a deferred scope
+struct deferred_pair {
+    int first;
+    int second;
+};
+
+packer& operator<<(packer& p, const deferred_pair& v) {
+    p.begin_array() << v.first << v.second;
+    return p.end_array();
+}
+
+TEST(MSGPACK_PACKER_BASE, msgpack_deferred_length) {
+    // matches the encoding of known lengths, in every header size
+    for (const int n : { 0, 3, 15, 16, 1000, 70000 }) {
+        vector<int> values;
+        packer p;
+        p.begin_array();
+        for (int i = 0; i < n; ++i) {
+            p << i;
+            values.push_back(i);
+        }
+        p.end_array();
+
+        packer expected;
+        expected << values;
+        EXPECT_EQ(p.get_buffer(), expected.get_buffer());
+    }
+
+    // nested scopes and fixed-length containers within
+    packer p;
+    p.begin_map();
+    p << "odd";
+    p.begin_array();
+    for (int i = 0; i < 40; ++i) {
+        if (i % 2 != 0) { p << i; }
+    }
+    p.end_array();
+    p << "nested" << vector<string>{ "a", "b" } << "empty";
+    p.begin_map().end_map();
+    p.end_map();
+
+    packer expected;
+    expected.map("odd", vector<int>{ 1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31, 33, 35, 37, 39 },
+                 "nested", vector<string>{ "a", "b" },
+                 "empty", map<string, int>{});
+    EXPECT_EQ(p.get_buffer(), expected.get_buffer());
+
+    // deferred scopes within fixed-length containers count their own values
+    packer d;
+    d << vector<deferred_pair>{{ 1, 2 }, { 3, 4 }};
+    d.map("pair", deferred_pair{ 5, 6 });
+    EXPECT_EQ(d.get_buffer(), (vector<uint8_t>{ 0x92, 0x92, 0x01, 0x02, 0x92, 0x03, 0x04, 0x81, 0xa4, 'p', 'a', 'i', 'r',
+                                                0x92, 0x05, 0x06 }));
+    unpacker w{ d.get_buffer() };
+    EXPECT_EQ(get_value<vector<vector<int>>>(w), (vector<vector<int>>{{ 1, 2 }, { 3, 4 }}));
+
+    // the 32-bit header is kept in fixed width mode
+    basic_packer<fixed_packer_traits> f;
+    f.begin_array() << 1 << 2;
+    f.end_array();
+    EXPECT_EQ(f.get_buffer().size(), 5u + 2 * 5u);
+    EXPECT_EQ(f.get_buffer()[0], 0xddu);
+    unpacker v{ f.get_buffer() };
+    EXPECT_EQ(get_value<vector<int>>(v), (vector<int>{ 1, 2 }));
+}
+
+TEST(MSGPACK_PACKER_BASE, msgpack_mutable_view) {
+    packer p;
+    p.map("route", vector<int>{ 1, 2, 3 },
+          "ttl", fixed(int32_t{ 64 }),
+          "hops", 3,
+          "sent", fixed(timestamp{ 100, 0 }),
+          "ok", false,
+          "load", 0.5f);
+    vector<uint8_t> buffer = p.get_buffer();
+
+    mutable_view message{ buffer };
+    ASSERT_TRUE(message.valid());
+    EXPECT_EQ(message.view().size, buffer.size());
+
+    mutable_view v;
+    ASSERT_EQ(message.find("ttl", v), E_OK);
+    EXPECT_EQ(v.set(-100000), E_OK);
+    ASSERT_EQ(message.find("hops", v), E_OK);
+    EXPECT_EQ(v.set(-5), E_OK);
+    EXPECT_EQ(v.set(200), E_CONVERSION);
+    EXPECT_EQ(v.set(true), E_CONVERSION);
+    ASSERT_EQ(message.find_path(v, "route", 2), E_OK);
+    EXPECT_EQ(v.set(127), E_OK);
+    ASSERT_EQ(message.find("sent", v), E_OK);
+    EXPECT_EQ(v.set(timestamp{ 200, 5 }), E_OK);
+    ASSERT_EQ(message.find("ok", v), E_OK);
+    EXPECT_EQ(v.set(true), E_OK);
+    ASSERT_EQ(message.find("load", v), E_OK);
+    EXPECT_EQ(v.set(0.25), E_OK);
+    EXPECT_EQ(v.set(0.1), E_CONVERSION);
+
+    EXPECT_EQ(message.find("missing", v), E_CONVERSION);
+    EXPECT_EQ(message.find_path(v, "route", 3), E_CONVERSION);
+    EXPECT_EQ(message.find_path(v, "ttl", 0), E_CONVERSION);
+    EXPECT_EQ(buffer.size(), p.get_buffer().size());
+
+
+    auto read = [&message](const char* key) {
+        mutable_view value;
+        message.find(key, strlen(key), value);
+        return unpacker{ value.view() };
+    };
+    unpacker ttl = read("ttl");
+    EXPECT_EQ(get_value<int>(ttl), -100000);
+    unpacker hops = read("hops");
+    EXPECT_EQ(get_value<int>(hops), -5);
+    unpacker route = read("route");
+    EXPECT_EQ(get_value<vector<int>>(route), (vector<int>{ 1, 2, 127 }));
+    unpacker sent = read("sent");
+    timestamp ts;
+    sent >> ts;
+    EXPECT_EQ(ts.seconds, 200);
+    EXPECT_EQ(ts.nanoseconds, 5u);
+    unpacker ok = read("ok");
+    EXPECT_TRUE(get_value<bool>(ok));
+    unpacker load = read("load");
+    EXPECT_EQ(get_value<float>(load), 0.25f);
+}
+
 TEST(MSGPACK_PACKER_BASE, msgpack_pack_unpacker_to_string) {
     EXPECT_EQ(test_pack_to_string(1, 10, "test"), "{1,10,\"test\"}");
     EXPECT_EQ(test_pack_to_string(vector<int>{1, 10, 20}), "{[1,10,20]}");
@@ -320,6 +1296,506 @@ TEST(MSGPACK_PACKER_BASE, msgpack_pack_unpacker_to_string) {
                                                    { "3", 30 }}), "{{\"1\":10,\"2\":20,\"3\":30}}");
 }
 
+TEST(MSGPACK_STATS, alloc_accounting) {
+    stats::local().reset();
+
+    packer p;
+    p << vector<int>(64, 1000) << string(100, 'x');
+
+    unpacker u{ p.get_buffer() };
+    vector<int> v;
+    string s;
+    u >> v >> s;
+
+    const alloc_stats& st = stats::local();
+    if (stats::enabled()) {
+        EXPECT_GT(st.allocations, 0u);
+        EXPECT_GE(st.bytes_allocated, p.get_buffer().size());
+        EXPECT_EQ(st.peak_buffer_size, p.get_buffer().size());
+    } else {
+        EXPECT_EQ(st.allocations, 0u);
+        EXPECT_EQ(st.bytes_allocated, 0u);
+        EXPECT_EQ(st.peak_buffer_size, 0u);
+    }
+}
+
+TEST(MSGPACK_STATS, small_packer) {
+    stats::local().reset();
+    small_packer<64> p;
+    p.map("seq", 1, "ack", true);
+    small_packer<64> copy{ p };
+    EXPECT_EQ(stats::local().allocations, 0u);
+
+    packer q;
+    q.map("seq", 1, "ack", true);
+    EXPECT_EQ(p.get_buffer(), q.get_buffer());
+    EXPECT_EQ(p.view().to_vector(), q.get_buffer());
+
+    // spills once, moving keeps the heap storage
+    stats::local().reset();
+    p << string(100, 'x');
+    const small_packer<64> moved{ std::move(p) };
+    EXPECT_EQ(stats::local().allocations, stats::enabled() ? 1u : 0u);
+
+    q << string(100, 'x');
+    EXPECT_EQ(moved.get_buffer(), q.get_buffer());
+
+    unpacker u{ copy.get_buffer() };
+    EXPECT_EQ(to_string(u), "{{\"ack\":true,\"seq\":1}}");
+}
+
+struct traced_packer_traits : default_packer_traits {
+    using tracer = stats_tracer;
+};
+
+struct traced_unpacker_traits : default_unpacker_traits {
+    using tracer = stats_tracer;
+};
+
+TEST(MSGPACK_TRACE, counters_and_histograms) {
+    stats_tracer::reset();
+
+    std::thread t([] {
+        basic_packer<traced_packer_traits> p;
+        p << vector<vector<int>>{{ 1, 2 }, { 3, 300 }} << string(40, 'x');
+
+        basic_unpacker<traced_unpacker_traits> u{ p.get_buffer() };
+        vector<vector<int>> v;
+        string s;
+        u >> v >> s;
+        u = basic_unpacker<traced_unpacker_traits>{ p.get_buffer() };
+        u >> skip;
+    });
+    t.join();
+
+    const trace_stats st = stats_tracer::collect();
+    EXPECT_EQ(st.encoded[types::SFIXARR], 3u);
+    EXPECT_EQ(st.encoded[types::SFIXINT], 3u);
+    EXPECT_EQ(st.encoded[types::SINT16], 1u);
+    EXPECT_EQ(st.encoded[types::SSTR8], 1u);
+    EXPECT_EQ(st.decoded[types::SFIXARR], 3u);
+    EXPECT_EQ(st.decoded[types::SFIXINT], 3u);
+    EXPECT_EQ(st.decoded[types::SINT16], 1u);
+    EXPECT_EQ(st.decoded[types::SSTR8], 1u);
+
+    EXPECT_EQ(st.histograms[H_ARRAY_LENGTH].buckets[log_histogram::bucket(2)], 6u);
+    EXPECT_EQ(st.histograms[H_STRING_LENGTH].buckets[log_histogram::bucket(40)], 2u);
+    EXPECT_EQ(st.histograms[H_DEPTH].buckets[log_histogram::bucket(2)], 6u);
+    EXPECT_EQ(st.histograms[H_SKIP_NS].count(), 1u);
+    EXPECT_EQ(st.histograms[H_MESSAGE_NS].count(), 1u);
+}
+
+TEST(MSGPACK_RING, spsc_frames) {
+    spsc_frame_ring ring{ 256 };
+    buffer_view frame;
+    EXPECT_FALSE(ring.try_peek(frame));
+
+    // lengths and strides fit the 32-bit fields of the frame headers
+    EXPECT_TRUE(spsc_frame_ring::valid_capacity(256));
+    EXPECT_FALSE(spsc_frame_ring::valid_capacity(1000));
+    if (sizeof(size_t) > 4) {
+        EXPECT_TRUE(mpsc_frame_ring::valid_capacity(static_cast<size_t>(mpsc_frame_ring::max_capacity)));
+        EXPECT_FALSE(mpsc_frame_ring::valid_capacity(static_cast<size_t>(mpsc_frame_ring::max_capacity * 2)));
+    }
+
+    // wraps around several times, frames never straddle the end of the ring
+    for (int i = 0; i < 100; ++i) {
+        spsc_frame_ring::reservation r;
+        ASSERT_TRUE(ring.try_reserve(64, r));
+        ring_packer<spsc_frame_ring> p{ ring, r };
+        p << i << string(static_cast<size_t>(i % 40), 'x');
+        EXPECT_TRUE(p.commit());
+
+        ASSERT_TRUE(ring.try_peek(frame));
+        unpacker u{ frame };
+        EXPECT_EQ(get_value<int>(u), i);
+        EXPECT_EQ(get_value<string>(u), string(static_cast<size_t>(i % 40), 'x'));
+        EXPECT_TRUE(u.empty());
+        ring.release();
+    }
+
+    // oversized frames are abandoned, a full ring refuses reservations
+    {
+        spsc_frame_ring::reservation r;
+        ASSERT_TRUE(ring.try_reserve(8, r));
+        ring_packer<spsc_frame_ring> p{ ring, r };
+        p << string(20, 'x');
+        EXPECT_FALSE(p.commit());
+    }
+    EXPECT_FALSE(ring.try_peek(frame));
+
+    // a compacted scope leaves no stale bytes where the next frame header goes
+    for (int i = 0; i < 2; ++i) {
+        spsc_frame_ring::reservation r;
+        ASSERT_TRUE(ring.try_reserve(64, r));
+        ring_packer<spsc_frame_ring> p{ ring, r };
+        p.begin_array();
+        for (int v = 1; v <= 7; ++v) { p << v; }
+        p.end_array();
+        EXPECT_TRUE(p.commit());
+
+        ASSERT_TRUE(ring.try_peek(frame));
+        unpacker u{ frame };
+        EXPECT_EQ(get_value<vector<int>>(u), (vector<int>{ 1, 2, 3, 4, 5, 6, 7 }));
+        ring.release();
+        EXPECT_FALSE(ring.try_peek(frame));
+    }
+
+    // bytes written past the committed size do not survive as a frame header
+    {
+        spsc_frame_ring::reservation r;
+        ASSERT_TRUE(ring.try_reserve(64, r));
+        memset(r.data, 0xff, r.capacity);
+        ring.commit(r, 3);
+        ASSERT_TRUE(ring.try_peek(frame));
+        EXPECT_EQ(frame.size, 3u);
+        ring.release();
+        EXPECT_FALSE(ring.try_peek(frame));
+
+        packer second;
+        second << "second";
+        EXPECT_TRUE(ring.try_push(second.view()));
+        ASSERT_TRUE(ring.try_peek(frame));
+        unpacker u{ frame };
+        EXPECT_EQ(get_value<string>(u), "second");
+        ring.release();
+    }
+
+    spsc_frame_ring full{ 256 };
+    packer p;
+    p << 1;
+    size_t pushed = 0;
+    while (full.try_push(p.view())) { ++pushed; }
+    EXPECT_EQ(pushed, full.capacity() / 16);
+    EXPECT_FALSE(full.try_push(buffer_view{}));
+}
+
+TEST(MSGPACK_RING, mpsc_frames) {
+    const int producers = 4;
+    const int frames = 20000;
+    mpsc_frame_ring ring{ 4096 };
+
+    vector<thread> threads;
+    for (int t = 0; t < producers; ++t) {
+        threads.emplace_back([&ring, t] {
+            for (int i = 0; i < frames; ++i) {
+                mpsc_frame_ring::reservation r;
+                while (!ring.try_reserve(32, r)) { this_thread::yield(); }
+                ring_packer<mpsc_frame_ring> p{ ring, r };
+                p << t << i;
+                p.commit();
+            }
+        });
+    }
+
+    vector<int> next(producers, 0);
+    for (int received = 0; received < producers * frames;) {
+        buffer_view frame;
+        if (!ring.try_peek(frame)) {
+            this_thread::yield();
+            continue;
+        }
+        unpacker u{ frame };
+        const int t = get_value<int>(u);
+        ASSERT_EQ(get_value<int>(u), next[static_cast<size_t>(t)]++);
+        ring.release();
+        ++received;
+    }
+
+    for (thread& t : threads) { t.join(); }
+    EXPECT_EQ(next, vector<int>(producers, frames));
+}
+
+#if defined(__linux__)
+#include <sys/wait.h>
+
+TEST(MSGPACK_RING, shm_channel) {
+    const int frames = 100000;
+    spsc_shm_channel channel;
+    ASSERT_EQ(channel.create(1 << 16), 0);
+    EXPECT_EQ(channel.create(1000), EINVAL);
+    ASSERT_EQ(channel.create(1 << 16), 0);
+
+    const pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        // producer process, maps the inherited memfd
+        spsc_shm_channel producer;
+        if (producer.open(dup(channel.fd())) != 0) { _exit(1); }
+        for (int i = 0; i < frames; ++i) {
+            spsc_shm_channel::reservation r;
+            while (!producer.try_reserve(16, r)) { producer.notify(); }
+            ring_packer<spsc_frame_ring> p{ producer.ring(), r };
+            p << i;
+            p.commit();
+            if (i % 64 == 63) { producer.notify(); }
+        }
+        producer.notify();
+        _exit(0);
+    }
+
+    int next = 0;
+    while (next < frames && channel.wait(5000)) {
+        buffer_view frame;
+        while (channel.try_peek(frame)) {
+            unpacker u{ frame };
+            ASSERT_EQ(get_value<int>(u), next++);
+            channel.release();
+        }
+    }
+    EXPECT_EQ(next, frames);
+    EXPECT_FALSE(channel.wait(10));
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+TEST(MSGPACK_RING, shm_channel_named) {
+    const string name = "/msgpack_test_" + to_string(getpid());
+    spsc_shm_channel::remove(name.c_str());
+    spsc_shm_channel creator;
+    ASSERT_EQ(creator.create(name.c_str(), 1 << 12), 0);
+    EXPECT_EQ(spsc_shm_channel{}.create(name.c_str(), 1 << 12), EEXIST);
+    spsc_shm_channel opened;
+    ASSERT_EQ(opened.open(name.c_str()), 0);
+
+    // the creator removes the name, mappings stay usable
+    creator.close();
+    EXPECT_EQ(spsc_shm_channel{}.open(name.c_str()), ENOENT);
+    EXPECT_EQ(spsc_shm_channel::remove(name.c_str()), ENOENT);
+    const uint8_t byte = 0x01;
+    EXPECT_TRUE(opened.try_push(buffer_view{ &byte, 1 }));
+    EXPECT_TRUE(opened.wait(0));
+
+    buffer_view frame;
+    EXPECT_TRUE(opened.try_peek(frame));
+    opened.release();
+
+    // wakeups without frames do not extend the timeout
+    std::atomic<bool> done{ false };
+    std::thread waker([&opened, &done]() {
+        while (!done.load()) {
+            opened.notify();
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    });
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(opened.wait(50));
+    const auto waited = std::chrono::steady_clock::now() - start;
+    done.store(true);
+    waker.join();
+    EXPECT_GE(waited, std::chrono::milliseconds(50));
+    EXPECT_LT(waited, std::chrono::milliseconds(1000));
+}
+#endif
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/socket.h>
+
+TEST(MSGPACK_FD, socketpair_framing) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    for (int fd : fds) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); }
+
+    // a value split across reads is only handed out once complete
+    packer p;
+    p << string(100, 'x');
+    const vector<uint8_t> bytes = p.get_buffer();
+    ASSERT_EQ(write(fds[0], bytes.data(), 10), 10);
+
+    frame_reader reader{ 16 };
+    vector<buffer_view> frames;
+    EXPECT_EQ(reader.read(fds[1]), 0);
+    EXPECT_EQ(reader.frames(frames), E_OK);
+    EXPECT_TRUE(frames.empty());
+
+    frame_writer writer;
+    writer.push(buffer_view{ bytes.data() + 10, bytes.size() - 10 });
+    packer q;
+    q << 1;
+    writer.push(q);
+    q << 2;
+    writer.push(q);
+    EXPECT_EQ(writer.flush(fds[0]), 0);
+    EXPECT_TRUE(writer.empty());
+
+    EXPECT_EQ(reader.read(fds[1]), 0);
+    EXPECT_EQ(reader.frames(frames), E_OK);
+    ASSERT_EQ(frames.size(), 3);
+    EXPECT_EQ(frames[0].to_vector(), bytes);
+    unpacker u{ frames[2] };
+    EXPECT_EQ(get_value<int>(u), 2);
+    reader.consume();
+    EXPECT_EQ(reader.buffered(), 0);
+
+    // not msgpack
+    const uint8_t invalid = 0xc1;
+    ASSERT_EQ(write(fds[0], &invalid, 1), 1);
+    EXPECT_EQ(reader.read(fds[1]), EBADMSG);
+    EXPECT_EQ(reader.frames(frames), E_CONVERSION);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(MSGPACK_FD, frame_limits) {
+    // deep nesting fails instead of overflowing the stack
+    const vector<uint8_t> nested(2 * 1024 * 1024, 0x91);
+    unpacker u{ nested };
+    EXPECT_EQ(u.try_skip(), E_DEPTH);
+    EXPECT_EQ(u.view().size, nested.size());
+    EXPECT_THROW(u.skip(), output_conversion_error);
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    for (int fd : fds) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); }
+    ASSERT_GT(write(fds[0], nested.data(), nested.size()), 0);
+    frame_reader reader;
+    vector<buffer_view> frames;
+    EXPECT_EQ(reader.read(fds[1]), EBADMSG);
+    EXPECT_EQ(reader.frames(frames), E_DEPTH);
+    EXPECT_TRUE(frames.empty());
+    close(fds[0]);
+    close(fds[1]);
+
+    // frames over the limit are rejected from their header, values arriving byte by byte
+    // are handed out once complete
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    for (int fd : fds) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); }
+    packer p;
+    p << vector<string>{ "a", string(300, 'b') } << string(1000, 'c');
+    const vector<uint8_t> bytes = p.get_buffer();
+    frame_reader limited{ 16, 512 };
+    for (size_t i = 0; i < 306; ++i) {
+        ASSERT_EQ(write(fds[0], bytes.data() + i, 1), 1);
+        EXPECT_EQ(limited.read(fds[1]), 0);
+    }
+    EXPECT_EQ(limited.frames(frames), E_OK);
+    ASSERT_EQ(frames.size(), 1u);
+    EXPECT_EQ(frames[0].size, 306u);
+    ASSERT_EQ(write(fds[0], bytes.data() + 306, 3), 3);
+    EXPECT_EQ(limited.read(fds[1]), EBADMSG);
+    EXPECT_EQ(limited.frames(frames), E_CONVERSION);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(MSGPACK_FD, epoll_connection) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    for (int fd : fds) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); }
+
+    fd_connection out{ fds[0] };
+    fd_connection in{ fds[1] };
+
+    // more than the socket buffer holds, the writer has to wait for output readiness
+    const int count = 2000;
+    for (int i = 0; i < count; ++i) {
+        packer p;
+        p.array(i, string(1000, 'x'));
+        out.writer().push(p);
+    }
+
+    const int ep = epoll_create1(0);
+    epoll_event ev{};
+    ev.events = out.events();
+    ev.data.ptr = &out;
+    ASSERT_EQ(epoll_ctl(ep, EPOLL_CTL_ADD, out.fd(), &ev), 0);
+    ev.events = in.events();
+    ev.data.ptr = &in;
+    ASSERT_EQ(epoll_ctl(ep, EPOLL_CTL_ADD, in.fd(), &ev), 0);
+
+    int next = 0;
+    bool ordered = true;
+    while (next < count) {
+        epoll_event ready[2];
+        const int n = epoll_wait(ep, ready, 2, 5000);
+        ASSERT_GT(n, 0);
+        for (int i = 0; i < n; ++i) {
+            fd_connection& c = *static_cast<fd_connection*>(ready[i].data.ptr);
+            ASSERT_EQ(c.on_event(ready[i].events, [&](buffer_view frame) {
+                unpacker u{ frame };
+                vector<unpacker> message;
+                u >> message;
+                ordered = ordered && get_value<int>(message[0]) == next++;
+            }), 0);
+            ev.events = c.events();
+            ev.data.ptr = &c;
+            epoll_ctl(ep, EPOLL_CTL_MOD, c.fd(), &ev);
+        }
+    }
+    EXPECT_TRUE(ordered);
+    EXPECT_TRUE(out.writer().empty());
+
+    close(fds[0]);
+    EXPECT_EQ(in.on_event(EPOLLIN, [](buffer_view) {}), 0);
+    EXPECT_TRUE(in.closed());
+
+    close(fds[1]);
+    close(ep);
+}
+#endif
+
+TEST(MSGPACK_FD, streaming_packer) {
+    auto snapshot = [](streaming_packer& p) {
+        for (int i = 0; i < 100; ++i) {
+            p.map("id", i, "name", string(static_cast<size_t>(i), 'x'), "values", vector<int>(20, i));
+        }
+        p << string(1000, 'y');
+        p.begin_array() << 1 << "two";
+        p.end_array();
+        p.flush();
+    };
+    packer expected;
+    for (int i = 0; i < 100; ++i) {
+        expected.map("id", i, "name", string(static_cast<size_t>(i), 'x'), "values", vector<int>(20, i));
+    }
+    expected << string(1000, 'y');
+    expected.array(1, "two");
+    const vector<uint8_t> bytes = expected.get_buffer();
+
+    // the buffer never holds more than the watermark and one value
+    vector<uint8_t> out;
+    size_t peak = 0;
+    streaming_packer p;
+    p.sink([&out, &p, &peak](const uint8_t* data, size_t size) {
+        peak = std::max(peak, p.buffer().size());
+        out.insert(out.end(), data, data + size);
+        return 0;
+    }, 128);
+    snapshot(p);
+    EXPECT_EQ(p.sink_error(), 0);
+    EXPECT_TRUE(p.buffer().empty());
+    EXPECT_EQ(out, bytes);
+    EXPECT_LT(peak, 256u);
+
+    FILE* f = tmpfile();
+    ASSERT_NE(f, nullptr);
+    {
+        mapped_file_sink file{ fileno(f), 4096 };
+        streaming_packer q;
+        q.sink(std::ref(file), 100);
+        snapshot(q);
+        EXPECT_EQ(q.sink_error(), 0);
+        EXPECT_EQ(file.size(), bytes.size());
+        EXPECT_EQ(file.close(), 0);
+    }
+    vector<uint8_t> read_back(bytes.size() + 1);
+    EXPECT_EQ(pread(fileno(f), read_back.data(), read_back.size(), 0), static_cast<ssize_t>(bytes.size()));
+    read_back.pop_back();
+    EXPECT_EQ(read_back, bytes);
+
+    // errors stop the output
+    streaming_packer r;
+    r.sink(fd_sink{ -1 }, 16);
+    snapshot(r);
+    EXPECT_EQ(r.sink_error(), EBADF);
+    EXPECT_TRUE(r.buffer().empty());
+    fclose(f);
+}
+
 TEST(MSGPACK_INTEGRATION, structure) {
     vector<uint8_t> v = { 135, 163, 105, 110, 116, 1, 165, 102, 108, 111, 97, 116, 203, 63, 224, 0, 0, 0, 0, 0, 0, 167,
                           98, 111, 111, 108, 101, 97, 110, 195, 164, 110, 117, 108, 108, 192, 166, 115, 116, 114, 105,
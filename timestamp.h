@@ -0,0 +1,41 @@
+#ifndef MSGPACK_TIMESTAMP_H
+#define MSGPACK_TIMESTAMP_H
+
+#include <chrono>
+#include <cstdint>
+
+//*****************************************************************************
+// MessagePack timestamp extension (type -1). Points in time are split into
+// seconds since the unix epoch and a nanosecond fraction in [0, 1e9).
+//*****************************************************************************
+
+namespace msgpack {
+
+struct timestamp {
+    static constexpr int8_t ext_type = -1;
+    static constexpr uint32_t max_nanoseconds = 999999999;
+
+    int64_t seconds;
+    uint32_t nanoseconds;
+
+    // the most compact of the timestamp 32, 64 and 96 encodings
+    bool fits_32() const { return nanoseconds == 0 && (seconds >> 32) == 0; }
+    bool fits_64() const { return (seconds >> 34) == 0; }
+
+    template<typename Rep, typename Period> static timestamp from(const std::chrono::duration<Rep, Period>& d) {
+        // rounds towards negative infinity, the fraction is never negative
+        std::chrono::seconds s = std::chrono::duration_cast<std::chrono::seconds>(d);
+        if (s > d) { s -= std::chrono::seconds{ 1 }; }
+        const std::chrono::nanoseconds ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d - s);
+        return timestamp{ static_cast<int64_t>(s.count()), static_cast<uint32_t>(ns.count()) };
+    }
+
+    template<typename Duration> Duration to() const {
+        return std::chrono::duration_cast<Duration>(std::chrono::seconds{ seconds })
+               + std::chrono::duration_cast<Duration>(std::chrono::nanoseconds{ nanoseconds });
+    }
+};
+
+}
+
+#endif //MSGPACK_TIMESTAMP_H
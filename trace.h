@@ -0,0 +1,272 @@
+#ifndef MSGPACK_TRACE_H
+#define MSGPACK_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include "platform.h"
+#include "types.h"
+
+//*****************************************************************************
+// Tracing policies for packer and unpacker, selected through their traits.
+// null_tracer compiles to nothing, stats_tracer collects per-thread counters
+// and log-bucketed histograms which are merged on demand.
+//*****************************************************************************
+
+namespace msgpack {
+
+enum latency_t {
+    L_SKIP,
+    L_MESSAGE,
+};
+
+enum histogram_t {
+    H_STRING_LENGTH,
+    H_BINARY_LENGTH,
+    H_ARRAY_LENGTH,
+    H_MAP_LENGTH,
+    H_DEPTH,
+    H_SKIP_NS,
+    H_MESSAGE_NS,
+    H_COUNT,
+};
+
+struct null_tracer {
+    static void on_decode(types::storage_type_t) {}
+    static void on_encode(types::storage_type_t) {}
+    static void on_length(types::data_type_t, size_t) {}
+    static void enter() {}
+    static void leave() {}
+
+    struct timer {
+        explicit timer(latency_t) {}
+    };
+};
+
+// reports entering and leaving a container to the tracer
+template<typename Tracer> struct trace_scope {
+    trace_scope() { Tracer::enter(); }
+    ~trace_scope() { Tracer::leave(); }
+
+    trace_scope(const trace_scope&) = delete;
+    trace_scope& operator=(const trace_scope&) = delete;
+};
+
+// bucket 0 counts zeros, bucket i counts values in [2^(i-1), 2^i)
+struct log_histogram {
+    static constexpr size_t bucket_count = 65;
+
+    uint64_t buckets[bucket_count];
+
+    log_histogram() : buckets() {}
+
+    static size_t bucket(const uint64_t v) { return platform::bit_width(v); }
+
+    void record(const uint64_t v) { ++buckets[bucket(v)]; }
+
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (uint64_t b : buckets) { n += b; }
+        return n;
+    }
+
+    // upper bound of the bucket containing the p-th fraction of the recorded values
+    uint64_t percentile(const double p) const {
+        const uint64_t total = count();
+        const uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            seen += buckets[i];
+            if (seen > rank || (seen == total && seen != 0)) {
+                return i == 0 ? 0 : (i == 64 ? std::numeric_limits<uint64_t>::max() : (uint64_t{ 1 } << i) - 1);
+            }
+        }
+        return 0;
+    }
+
+    log_histogram& operator+=(const log_histogram& other) {
+        for (size_t i = 0; i < bucket_count; ++i) { buckets[i] += other.buckets[i]; }
+        return *this;
+    }
+};
+
+struct trace_stats {
+    uint64_t decoded[types::storage_type_count];
+    uint64_t encoded[types::storage_type_count];
+    log_histogram histograms[H_COUNT];
+
+    trace_stats() : decoded(), encoded() {}
+
+    trace_stats& operator+=(const trace_stats& other) {
+        for (size_t i = 0; i < types::storage_type_count; ++i) {
+            decoded[i] += other.decoded[i];
+            encoded[i] += other.encoded[i];
+        }
+        for (size_t i = 0; i < H_COUNT; ++i) { histograms[i] += other.histograms[i]; }
+        return *this;
+    }
+};
+
+// counter written by the owning thread only, read concurrently by collectors
+class trace_counter {
+public:
+    void add(const uint64_t n) {
+        _value.store(_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t load() const { return _value.load(std::memory_order_relaxed); }
+
+    void reset() { _value.store(0, std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> _value{ 0 };
+};
+
+struct trace_block {
+    trace_counter decoded[types::storage_type_count];
+    trace_counter encoded[types::storage_type_count];
+    trace_counter histograms[H_COUNT][log_histogram::bucket_count];
+    size_t depth = 0;
+
+    void record(const histogram_t h, const uint64_t v) { histograms[h][log_histogram::bucket(v)].add(1); }
+
+    void collect(trace_stats& s) const {
+        for (size_t i = 0; i < types::storage_type_count; ++i) {
+            s.decoded[i] += decoded[i].load();
+            s.encoded[i] += encoded[i].load();
+        }
+        for (size_t h = 0; h < H_COUNT; ++h) {
+            for (size_t i = 0; i < log_histogram::bucket_count; ++i) {
+                s.histograms[h].buckets[i] += histograms[h][i].load();
+            }
+        }
+    }
+
+    void reset() {
+        for (trace_counter& c : decoded) { c.reset(); }
+        for (trace_counter& c : encoded) { c.reset(); }
+        for (auto& h : histograms) {
+            for (trace_counter& c : h) { c.reset(); }
+        }
+    }
+};
+
+class trace_registry {
+public:
+    static trace_registry& instance() {
+        static trace_registry r;
+        return r;
+    }
+
+    void attach(trace_block* b) {
+        std::lock_guard<std::mutex> lock{ _mutex };
+        _blocks.push_back(b);
+    }
+
+    void detach(trace_block* b) {
+        std::lock_guard<std::mutex> lock{ _mutex };
+        b->collect(_retired);
+        _blocks.erase(std::remove(_blocks.begin(), _blocks.end(), b), _blocks.end());
+    }
+
+    trace_stats collect() {
+        std::lock_guard<std::mutex> lock{ _mutex };
+        trace_stats s = _retired;
+        for (const trace_block* b : _blocks) { b->collect(s); }
+        return s;
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock{ _mutex };
+        _retired = trace_stats{};
+        for (trace_block* b : _blocks) { b->reset(); }
+    }
+
+private:
+    std::mutex _mutex;
+    std::vector<trace_block*> _blocks;
+    trace_stats _retired;
+};
+
+struct stats_tracer {
+    static void on_decode(const types::storage_type_t st) { local().decoded[st].add(1); }
+
+    static void on_encode(const types::storage_type_t st) { local().encoded[st].add(1); }
+
+    static void on_length(const types::data_type_t t, const size_t length) {
+        switch (t) {
+            case types::T_STRING:
+                local().record(H_STRING_LENGTH, length);
+                break;
+            case types::T_BINARY:
+                local().record(H_BINARY_LENGTH, length);
+                break;
+            case types::T_ARRAY:
+                local().record(H_ARRAY_LENGTH, length);
+                break;
+            case types::T_MAP:
+                local().record(H_MAP_LENGTH, length);
+                break;
+            default:
+                break;
+        }
+    }
+
+    static void enter() {
+        trace_block& b = local();
+        b.record(H_DEPTH, ++b.depth);
+    }
+
+    static void leave() { --local().depth; }
+
+    // measures top level operations only, nested ones are part of the enclosing measurement
+    class timer {
+    public:
+        explicit timer(const latency_t l)
+                : _latency(l), _top(local().depth == 0), _start(_top ? clock::now() : clock::time_point{}) {}
+
+        ~timer() {
+            if (_top) {
+                const uint64_t ns = static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - _start).count());
+                local().record(_latency == L_SKIP ? H_SKIP_NS : H_MESSAGE_NS, ns);
+            }
+        }
+
+        timer(const timer&) = delete;
+        timer& operator=(const timer&) = delete;
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        const latency_t _latency;
+        const bool _top;
+        const clock::time_point _start;
+    };
+
+    // merged statistics of all threads, including finished ones
+    static trace_stats collect() { return trace_registry::instance().collect(); }
+
+    static void reset() { trace_registry::instance().reset(); }
+
+private:
+    struct local_block {
+        trace_block block;
+
+        local_block() { trace_registry::instance().attach(&block); }
+
+        ~local_block() { trace_registry::instance().detach(&block); }
+    };
+
+    static trace_block& local() {
+        static thread_local local_block l;
+        return l.block;
+    }
+};
+
+}
+
+#endif //MSGPACK_TRACE_H
@@ -0,0 +1,175 @@
+#ifndef MSGPACK_TYPES_H
+#define MSGPACK_TYPES_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace msgpack {
+
+struct types {
+    enum data_type_t {
+        T_UNKNOWN,
+        T_BOOLEAN,
+        T_NULL,
+        T_INT8,
+        T_INT16,
+        T_INT32,
+        T_INT64,
+        T_UINT8,
+        T_UINT16,
+        T_UINT32,
+        T_UINT64,
+        T_FLOAT,
+        T_DOUBLE,
+        T_STRING,
+        T_BINARY,
+        T_EXTERNAL,
+        T_ARRAY,
+        T_MAP,
+    };
+
+    enum storage_type_t : uint8_t {
+        SFIXINT = 1,
+        SFIXARR = 2,
+        SFIXMAP = 3,
+        SFIXSTR = 4,
+        SNIL = 5,
+        SUNUSED = 0,
+        SFALSE = 6,
+        STRUE = 7,
+        SBIN8 = 8,
+        SBIN16 = 9,
+        SBIN32 = 10,
+        SEXT8 = 11,
+        SEXT16 = 12,
+        SEXT32 = 13,
+        SFLT32 = 14,
+        SFLT64 = 15,
+        SUINT8 = 16,
+        SUINT16 = 17,
+        SUINT32 = 18,
+        SUINT64 = 19,
+        SINT8 = 20,
+        SINT16 = 21,
+        SINT32 = 22,
+        SINT64 = 23,
+
+        SFEXT1 = 24,
+        SFEXT2 = 25,
+        SFEXT4 = 26,
+        SFEXT8 = 27,
+        SFEXT16 = 28,
+        SSTR8 = 29,
+        SSTR16 = 30,
+        SSTR32 = 31,
+        SARR16 = 32,
+        SARR32 = 33,
+        SMAP16 = 34,
+        SMAP32 = 35,
+        SFIXNINT = 36,
+    };
+
+    static constexpr size_t storage_type_count = 37;
+
+    // everything known about a value from its header byte
+    struct descriptor {
+        storage_type_t storage;
+        uint8_t type;       // data_type_t
+        uint8_t payload;    // fixed bytes after the header and length field, the type byte of extensions
+        uint8_t length;     // width of the length field, 0 if the length is in the header
+        uint8_t value;      // value or length held in the header itself
+    };
+
+    inline static const descriptor& describe(uint8_t b);
+    inline static storage_type_t storage_type(uint8_t b);
+    inline static data_type_t data_type(storage_type_t st);
+
+private:
+    static constexpr descriptor make_descriptor(const storage_type_t st, const data_type_t t, const uint8_t payload,
+                                                const uint8_t length, const uint8_t value) {
+        return descriptor{ st, static_cast<uint8_t>(t), payload, length, value };
+    }
+
+    // @formatter:off
+    static constexpr descriptor make_descriptor(const uint8_t b) {
+        return b <= 0x7f ? make_descriptor(SFIXINT,  T_INT8,     0,  0, b) :
+               b <= 0x8f ? make_descriptor(SFIXMAP,  T_MAP,      0,  0, b & 0x0fu) :
+               b <= 0x9f ? make_descriptor(SFIXARR,  T_ARRAY,    0,  0, b & 0x0fu) :
+               b <= 0xbf ? make_descriptor(SFIXSTR,  T_STRING,   0,  0, b & 0x1fu) :
+               b == 0xc0 ? make_descriptor(SNIL,     T_NULL,     0,  0, 0) :
+               b == 0xc1 ? make_descriptor(SUNUSED,  T_UNKNOWN,  0,  0, 0) :
+               b == 0xc2 ? make_descriptor(SFALSE,   T_BOOLEAN,  0,  0, 0) :
+               b == 0xc3 ? make_descriptor(STRUE,    T_BOOLEAN,  0,  0, 1) :
+               b == 0xc4 ? make_descriptor(SBIN8,    T_BINARY,   0,  1, 0) :
+               b == 0xc5 ? make_descriptor(SBIN16,   T_BINARY,   0,  2, 0) :
+               b == 0xc6 ? make_descriptor(SBIN32,   T_BINARY,   0,  4, 0) :
+               b == 0xc7 ? make_descriptor(SEXT8,    T_EXTERNAL, 1,  1, 0) :
+               b == 0xc8 ? make_descriptor(SEXT16,   T_EXTERNAL, 1,  2, 0) :
+               b == 0xc9 ? make_descriptor(SEXT32,   T_EXTERNAL, 1,  4, 0) :
+               b == 0xca ? make_descriptor(SFLT32,   T_FLOAT,    4,  0, 0) :
+               b == 0xcb ? make_descriptor(SFLT64,   T_DOUBLE,   8,  0, 0) :
+               b == 0xcc ? make_descriptor(SUINT8,   T_UINT8,    1,  0, 0) :
+               b == 0xcd ? make_descriptor(SUINT16,  T_UINT16,   2,  0, 0) :
+               b == 0xce ? make_descriptor(SUINT32,  T_UINT32,   4,  0, 0) :
+               b == 0xcf ? make_descriptor(SUINT64,  T_UINT64,   8,  0, 0) :
+               b == 0xd0 ? make_descriptor(SINT8,    T_INT8,     1,  0, 0) :
+               b == 0xd1 ? make_descriptor(SINT16,   T_INT16,    2,  0, 0) :
+               b == 0xd2 ? make_descriptor(SINT32,   T_INT32,    4,  0, 0) :
+               b == 0xd3 ? make_descriptor(SINT64,   T_INT64,    8,  0, 0) :
+               b == 0xd4 ? make_descriptor(SFEXT1,   T_EXTERNAL, 2,  0, 0) :
+               b == 0xd5 ? make_descriptor(SFEXT2,   T_EXTERNAL, 3,  0, 0) :
+               b == 0xd6 ? make_descriptor(SFEXT4,   T_EXTERNAL, 5,  0, 0) :
+               b == 0xd7 ? make_descriptor(SFEXT8,   T_EXTERNAL, 9,  0, 0) :
+               b == 0xd8 ? make_descriptor(SFEXT16,  T_EXTERNAL, 17, 0, 0) :
+               b == 0xd9 ? make_descriptor(SSTR8,    T_STRING,   0,  1, 0) :
+               b == 0xda ? make_descriptor(SSTR16,   T_STRING,   0,  2, 0) :
+               b == 0xdb ? make_descriptor(SSTR32,   T_STRING,   0,  4, 0) :
+               b == 0xdc ? make_descriptor(SARR16,   T_ARRAY,    0,  2, 0) :
+               b == 0xdd ? make_descriptor(SARR32,   T_ARRAY,    0,  4, 0) :
+               b == 0xde ? make_descriptor(SMAP16,   T_MAP,      0,  2, 0) :
+               b == 0xdf ? make_descriptor(SMAP32,   T_MAP,      0,  4, 0) :
+                           make_descriptor(SFIXNINT, T_INT8,     0,  0, b);
+    }
+    // @formatter:on
+};
+
+#define MSGPACK_DESCRIPTOR_4(_B) make_descriptor(_B), make_descriptor(_B + 1), make_descriptor(_B + 2), make_descriptor(_B + 3)
+#define MSGPACK_DESCRIPTOR_16(_B) MSGPACK_DESCRIPTOR_4(_B), MSGPACK_DESCRIPTOR_4(_B + 4), \
+                                  MSGPACK_DESCRIPTOR_4(_B + 8), MSGPACK_DESCRIPTOR_4(_B + 12)
+#define MSGPACK_DESCRIPTOR_64(_B) MSGPACK_DESCRIPTOR_16(_B), MSGPACK_DESCRIPTOR_16(_B + 16), \
+                                  MSGPACK_DESCRIPTOR_16(_B + 32), MSGPACK_DESCRIPTOR_16(_B + 48)
+
+const types::descriptor& types::describe(uint8_t b) {
+    // one lookup per value, computed at compile time
+    static constexpr descriptor table[256] = {
+            MSGPACK_DESCRIPTOR_64(0x00), MSGPACK_DESCRIPTOR_64(0x40),
+            MSGPACK_DESCRIPTOR_64(0x80), MSGPACK_DESCRIPTOR_64(0xc0)
+    };
+    return table[b];
+}
+
+#undef MSGPACK_DESCRIPTOR_64
+#undef MSGPACK_DESCRIPTOR_16
+#undef MSGPACK_DESCRIPTOR_4
+
+types::storage_type_t types::storage_type(uint8_t b) {
+    return describe(b).storage;
+}
+
+types::data_type_t types::data_type(storage_type_t st) {
+    // @formatter:off
+    static const data_type_t map_table[storage_type_count] {
+            /*  0 */ T_UNKNOWN, T_INT8, T_ARRAY, T_MAP, T_STRING, T_NULL, T_BOOLEAN, T_BOOLEAN,
+            /*  8 */ T_BINARY, T_BINARY, T_BINARY, T_EXTERNAL, T_EXTERNAL, T_EXTERNAL, T_FLOAT, T_DOUBLE,
+            /* 16 */ T_UINT8, T_UINT16, T_UINT32, T_UINT64, T_INT8, T_INT16, T_INT32, T_INT64,
+            /* 24 */ T_EXTERNAL, T_EXTERNAL, T_EXTERNAL, T_EXTERNAL, T_EXTERNAL, T_STRING, T_STRING, T_STRING,
+            /* 32 */ T_ARRAY, T_ARRAY, T_MAP, T_MAP, T_INT8
+    };
+    // @formatter:on
+
+    return map_table[st];
+}
+
+}
+
+#endif //MSGPACK_TYPES_H
@@ -2,6 +2,7 @@
 #define MSGPACK_UNPACKER_H
 
 #include <limits>
+#include <chrono>
 #include <string>
 #include <iterator>
 #include <algorithm>
@@ -14,9 +15,30 @@
 #include <map>
 #include <unordered_map>
 #include <memory>
+#include <cstdlib>
+#include <stdexcept>
 #include <string>
-#include <codecvt>
+#include "buffer.h"
+#include "fields.h"
 #include "platform.h"
+#include "stats.h"
+#include "timestamp.h"
+#include "trace.h"
+#include "types.h"
+#include "utf8.h"
+
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#   define MSGPACK_HAS_EXCEPTIONS 1
+#else
+#   define MSGPACK_HAS_EXCEPTIONS 0
+#endif
+
+// propagates a non E_OK error code to the caller
+#define MSGPACK_TRY(...) \
+    do { \
+        const ::msgpack::error_code_t _msgpack_error = (__VA_ARGS__); \
+        if (_msgpack_error != ::msgpack::E_OK) { return _msgpack_error; } \
+    } while(0)
 
 namespace msgpack {
 
@@ -33,65 +55,314 @@ public:
     explicit output_underflow_error(const char* s) : std::logic_error(s) {}
 };
 
+enum error_code_t : uint8_t {
+    E_OK = 0,
+    E_UNDERFLOW,
+    E_CONVERSION,
+    E_DEPTH,
+    E_ENCODING,
+};
+
 struct unpacker_skip {};
 constexpr unpacker_skip const skip{};
 
-class unpacker {
+// Events of basic_unpacker::visit, visitors hide the members they are interested in.
+// Map entries are reported as alternating key and value events.
+struct visitor {
+    void on_nil() {}
+    void on_bool(bool) {}
+    void on_int(int64_t) {}
+    void on_uint(uint64_t) {}
+    void on_double(double) {}
+    // views into the unpacker buffer, valid as long as the buffer is
+    void on_str(const char*, size_t) {}
+    void on_bin(const uint8_t*, size_t) {}
+    void on_ext(int8_t, const uint8_t*, size_t) {}
+    void begin_array(size_t) {}
+    void end_array() {}
+    void begin_map(size_t) {}
+    void end_map() {}
+};
+
+struct default_unpacker_traits {
+    using tracer = null_tracer;
+    // bounds checked reads, unchecked unpackers only accept a validated_buffer
+    static constexpr bool checked = true;
+    // reject strings which are not valid UTF-8
+    static constexpr bool validate_utf8 = false;
+    // vectors and maps are overwritten rather than appended to, vector elements are decoded
+    // in place so their strings and containers keep their capacity, structs are reset to
+    // their defaults before their fields are decoded
+    static constexpr bool reuse_capacity = false;
+    // allocates buffer copies together with their shared state
+    using allocator_type = std::allocator<uint8_t>;
+    // structs remember the key layout of the last map they were decoded from, see map_shape
+    static constexpr bool cache_shapes = false;
+};
+
+struct unchecked_unpacker_traits : default_unpacker_traits {
+    static constexpr bool checked = false;
+};
+
+struct reuse_unpacker_traits : default_unpacker_traits {
+    static constexpr bool reuse_capacity = true;
+};
+
+struct shape_cache_unpacker_traits : default_unpacker_traits {
+    static constexpr bool cache_shapes = true;
+};
+
+template<typename Allocator> struct allocator_unpacker_traits : default_unpacker_traits {
+    using allocator_type = Allocator;
+};
+
+// The contents of a complete string value read as a view, e.g. a map key, whatever the width
+// of its header. False for values of other types.
+inline bool string_contents(const buffer_view value, buffer_view& contents) {
+    if (value.empty()) { return false; }
+    const types::descriptor& d = types::describe(value.data[0]);
+    const size_t header = size_t{ 1 } + d.length;
+    if (d.type != types::T_STRING || value.size < header) { return false; }
+    contents = buffer_view{ value.data + header, value.size - header };
+    return true;
+}
+
+// An object constructed in place through an allocator, which hands itself on to allocator
+// aware members, e.g. the std::pmr strings of a pair.
+template<typename T, typename Allocator> class allocator_constructed {
 public:
-    using buffer_type = std::vector<uint8_t>;
+    using allocator_type = typename std::allocator_traits<Allocator>::template rebind_alloc<T>;
+
+    explicit allocator_constructed(const Allocator& allocator) : _allocator(allocator) {
+        traits::construct(_allocator, get());
+    }
+
+    ~allocator_constructed() { traits::destroy(_allocator, get()); }
+
+    allocator_constructed(const allocator_constructed&) = delete;
+    allocator_constructed& operator=(const allocator_constructed&) = delete;
+
+    T& operator*() { return *get(); }
 
-    enum data_type_t {
-        T_UNKNOWN,
-        T_BOOLEAN,
-        T_NULL,
-        T_INT8,
-        T_INT16,
-        T_INT32,
-        T_INT64,
-        T_UINT8,
-        T_UINT16,
-        T_UINT32,
-        T_UINT64,
-        T_FLOAT,
-        T_DOUBLE,
-        T_STRING,
-        T_BINARY,
-        T_EXTERNAL,
-        T_ARRAY,
-        T_MAP,
+private:
+    using traits = std::allocator_traits<allocator_type>;
+
+    allocator_type _allocator;
+    alignas(T) unsigned char _storage[sizeof(T)];
+
+    T* get() { return reinterpret_cast<T*>(_storage); }
+};
+
+// The raw keys of a map in order, with the members they resolved to. A map of the same
+// layout is recognized by comparing each key and its header bytewise with the learned one,
+// so the string header is neither decoded nor the key hashed or looked up. Keys and values
+// alternate, values are still decoded one by one. A mismatch relearns the layout from the
+// differing key on.
+class map_shape {
+public:
+    struct entry {
+        uint32_t offset;
+        // the key including its header
+        uint32_t size;
+        uint8_t header;
+        types::storage_type_t storage;
+        // the member the key resolved to, 0 for unknown keys
+        size_t field;
     };
 
-    unpacker() = default;
-
-    explicit unpacker(const buffer_type& buf)
-            : _buffer(std::make_shared<buffer_type>(buf)), _it{ _buffer->cbegin() }, _it_end{ _buffer->cend() } {}
-    explicit unpacker(buffer_type&& buf)
-            : _buffer(std::make_shared<buffer_type>(move(buf))), _it{ _buffer->cbegin() }, _it_end{ _buffer->cend() } {}
-
-    inline unpacker& operator>>(bool& value);
-    inline unpacker& operator>>(int8_t& value);
-    inline unpacker& operator>>(int16_t& value);
-    inline unpacker& operator>>(int32_t& value);
-    inline unpacker& operator>>(int64_t& value);
-    inline unpacker& operator>>(uint8_t& value);
-    inline unpacker& operator>>(uint16_t& value);
-    inline unpacker& operator>>(uint32_t& value);
-    inline unpacker& operator>>(uint64_t& value);
-    inline unpacker& operator>>(float& value);
-    inline unpacker& operator>>(double& value);
-    inline unpacker& operator>>(std::string& value);
-    inline unpacker& operator>>(std::wstring& value);
-    inline unpacker& operator>>(unpacker& value);
-
-    inline unpacker& operator>>(const unpacker_skip) {
+    size_t size() const { return _entries.size(); }
+    const entry& operator[](size_t i) const { return _entries[i]; }
+    const uint8_t* key(const entry& e) const { return _keys.data() + e.offset; }
+
+    bool matches(const size_t i, const uint8_t* it, const size_t remaining) const {
+        return i < _entries.size() && _entries[i].size <= remaining
+               && platform::equal_bytes(it, key(_entries[i]), _entries[i].size);
+    }
+
+    // drops the entries from i on
+    void truncate(const size_t i) {
+        if (i >= _entries.size()) { return; }
+        _keys.resize(_entries[i].offset);
+        _entries.resize(i);
+    }
+
+    void add(const uint8_t* key, const size_t size, const size_t header, const types::storage_type_t storage,
+             const size_t field) {
+        _entries.push_back(entry{ static_cast<uint32_t>(_keys.size()), static_cast<uint32_t>(size),
+                                  static_cast<uint8_t>(header), storage, field });
+        _keys.insert(_keys.end(), key, key + size);
+    }
+
+private:
+    std::vector<uint8_t> _keys;
+    std::vector<entry> _entries;
+};
+
+// Buffer whose values were checked for bounds, valid headers and nesting depth in a single pass.
+class validated_buffer {
+public:
+    using buffer_type = std::vector<uint8_t>;
+
+    static constexpr size_t default_max_depth = 64;
+
+    validated_buffer() = default;
+
+    explicit validated_buffer(buffer_type buf, size_t max_depth = default_max_depth) {
+        init(std::move(buf), max_depth);
+    }
+
+    // the buffer and its shared state are allocated with the allocator of buf
+    template<typename Allocator>
+    explicit validated_buffer(std::vector<uint8_t, Allocator> buf, size_t max_depth = default_max_depth) {
+        init(std::move(buf), max_depth);
+    }
+
+    error_code_t error() const { return _error; }
+    explicit operator bool() const { return _error == E_OK; }
+
+private:
+    template<typename> friend class basic_unpacker;
+
+    std::shared_ptr<const void> _buffer;
+    buffer_view _view;
+    error_code_t _error = E_UNDERFLOW;
+
+    template<typename Allocator> void init(std::vector<uint8_t, Allocator>&& buf, const size_t max_depth) {
+        using vector_type = std::vector<uint8_t, Allocator>;
+        const Allocator allocator = buf.get_allocator();
+        const std::shared_ptr<vector_type> b = std::allocate_shared<vector_type>(allocator, std::move(buf));
+        MSGPACK_STATS_ALLOC(sizeof(vector_type));
+        MSGPACK_STATS_BUFFER(b->size());
+        _buffer = b;
+        _view = buffer_view{ b->data(), b->size() };
+
+        _error = E_OK;
+        const uint8_t* it = _view.begin();
+        while (it != _view.end() && _error == E_OK) {
+            _error = validate_value(it, _view.end(), max_depth);
+        }
+    }
+
+    inline static error_code_t validate_value(const uint8_t*& it, const uint8_t* end, size_t depth);
+
+    static error_code_t validate_bytes(const uint8_t*& it, const uint8_t* end, size_t count) {
+        if (count > static_cast<size_t>(end - it)) { return E_UNDERFLOW; }
+        it += count;
+        return E_OK;
+    }
+
+    template<typename T> static error_code_t validate_length(const uint8_t*& it, const uint8_t* end, size_t& len) {
+        if (sizeof(T) > static_cast<size_t>(end - it)) { return E_UNDERFLOW; }
+        len = platform::load_be<T>(it);
+        it += sizeof(T);
+        return E_OK;
+    }
+};
+
+inline validated_buffer validate(std::vector<uint8_t> buf, size_t max_depth = validated_buffer::default_max_depth) {
+    return validated_buffer{ std::move(buf), max_depth };
+}
+
+template<typename Traits = default_unpacker_traits> class basic_unpacker : public types {
+public:
+    using traits_type = Traits;
+    using tracer = typename Traits::tracer;
+    using allocator_type = typename Traits::allocator_type;
+    using buffer_type = std::vector<uint8_t, allocator_type>;
+
+    basic_unpacker() = default;
+
+    // the copy and its shared state are allocated with the allocator of buf
+    explicit basic_unpacker(const buffer_type& buf) {
+        static_assert(Traits::checked, "unchecked unpackers are constructed from a validated_buffer");
+        own(buf.get_allocator(), buf, buf.get_allocator());
+        // shared state plus the buffer copy
+        MSGPACK_STATS_ALLOC(sizeof(buffer_type));
+        if (!buf.empty()) { MSGPACK_STATS_ALLOC(buf.size()); }
+        MSGPACK_STATS_BUFFER(buf.size());
+    }
+    explicit basic_unpacker(buffer_type&& buf) {
+        static_assert(Traits::checked, "unchecked unpackers are constructed from a validated_buffer");
+        const allocator_type allocator = buf.get_allocator();
+        own(allocator, std::move(buf));
+        MSGPACK_STATS_ALLOC(sizeof(buffer_type));
+        MSGPACK_STATS_BUFFER(remaining());
+    }
+    // reads the bytes in place, they have to outlive the unpacker and its sub-unpackers
+    explicit basic_unpacker(const buffer_view buf) : _it{ buf.data }, _it_end{ buf.data + buf.size } {
+        static_assert(Traits::checked, "unchecked unpackers are constructed from a validated_buffer");
+    }
+    explicit basic_unpacker(const validated_buffer& buf)
+            : _buffer(buf._buffer), _it{ nullptr }, _it_end{ nullptr } {
+        check(buf.error());
+        _it = buf._view.begin();
+        _it_end = buf._view.end();
+    }
+
+    inline basic_unpacker& operator>>(bool& value);
+    inline basic_unpacker& operator>>(int8_t& value);
+    inline basic_unpacker& operator>>(int16_t& value);
+    inline basic_unpacker& operator>>(int32_t& value);
+    inline basic_unpacker& operator>>(int64_t& value);
+    inline basic_unpacker& operator>>(uint8_t& value);
+    inline basic_unpacker& operator>>(uint16_t& value);
+    inline basic_unpacker& operator>>(uint32_t& value);
+    inline basic_unpacker& operator>>(uint64_t& value);
+    inline basic_unpacker& operator>>(float& value);
+    inline basic_unpacker& operator>>(double& value);
+    // strings, containers and their elements use their own allocator, e.g. std::pmr::string
+    template<typename CharT, typename Allocator>
+    basic_unpacker& operator>>(std::basic_string<CharT, std::char_traits<CharT>, Allocator>& value);
+    inline basic_unpacker& operator>>(basic_unpacker& value);
+    inline basic_unpacker& operator>>(buffer_view& value);
+    inline basic_unpacker& operator>>(timestamp& value);
+
+    template<typename Duration>
+    basic_unpacker& operator>>(std::chrono::time_point<std::chrono::system_clock, Duration>& value) {
+        check(get(value));
+        return *this;
+    }
+
+    template<typename Rep, typename Period> basic_unpacker& operator>>(std::chrono::duration<Rep, Period>& value) {
+        check(get(value));
+        return *this;
+    }
+
+    // structs declaring their fields, see fields.h
+    template<typename T> typename std::enable_if<has_fields<T, basic_unpacker>::value, basic_unpacker&>::type
+    operator>>(T& value) {
+        check(get_fields(value));
+        return *this;
+    }
+
+    inline basic_unpacker& operator>>(const unpacker_skip) {
         return skip();
     }
 
-    template<typename T, typename F> unpacker& for_each(F f);
-    template<typename T> unpacker& operator>>(std::vector<T>& vec);
+    template<typename T, typename F> basic_unpacker& for_each(F f);
+    template<typename T, typename Allocator> basic_unpacker& operator>>(std::vector<T, Allocator>& vec);
 
-    template<typename K, typename V, typename F> unpacker& for_each(F f);
-    template<typename K, typename V> unpacker& operator>>(std::map<K, V>& map);
+    template<typename K, typename V, typename F> basic_unpacker& for_each(F f);
+    template<typename K, typename V, typename Compare, typename Allocator>
+    basic_unpacker& operator>>(std::map<K, V, Compare, Allocator>& map);
+
+    // Decodes consecutive values into the objects of [first, last) until either runs out and
+    // returns how many were decoded. With reuse_capacity in the traits, a pool of objects
+    // decoded message after message stops allocating once its capacity settles.
+    template<typename It> size_t get_batch(It first, It last) {
+        size_t count;
+        check(try_get_batch(first, last, count));
+        return count;
+    }
+
+    // on error count holds the objects decoded before, the failing one may be partially filled
+    template<typename It> error_code_t try_get_batch(It first, const It last, size_t& count) {
+        count = 0;
+        for (; first != last && !empty(); ++first, ++count) {
+            MSGPACK_TRY(try_get(*first));
+        }
+        return E_OK;
+    }
 
     template <typename T> T get_value() {
         T val;
@@ -99,504 +370,1017 @@ public:
         return val;
     }
 
+    // Non-throwing counterparts of the operators above. On error the read position is left
+    // unchanged, containers may however be partially filled.
+    template<typename T> error_code_t try_get(T& value) {
+        const iterator it = _it;
+        return restore(it, get(value));
+    }
+
+    template<typename T, typename F> error_code_t try_for_each(F f) {
+        const iterator it = _it;
+        return restore(it, get_array<T>(f));
+    }
+
+    template<typename K, typename V, typename F> error_code_t try_for_each(F f) {
+        const iterator it = _it;
+        return restore(it, get_map<K, V>(f));
+    }
+
+    // Reads only the header of an array or map, its elements or key and value pairs are read
+    // next. On error the read position is left unchanged.
+    error_code_t try_array_header(size_t& len) {
+        const iterator it = _it;
+        return restore(it, get_header(T_ARRAY, len));
+    }
+
+    error_code_t try_map_header(size_t& len) {
+        const iterator it = _it;
+        return restore(it, get_header(T_MAP, len));
+    }
+
+    // Push-parses the next value into the visitor without intermediate allocations. Containers
+    // nested deeper than max_depth fail with E_DEPTH instead of exhausting the stack.
+    template<typename V> basic_unpacker& visit(V& v, const size_t max_depth = validated_buffer::default_max_depth) {
+        check(visit_value(v, max_depth));
+        return *this;
+    }
+
+    // on error the read position is restored, events already delivered are not revoked
+    template<typename V> error_code_t try_visit(V& v, const size_t max_depth = validated_buffer::default_max_depth) {
+        const iterator it = _it;
+        return restore(it, visit_value(v, max_depth));
+    }
+
+    // containers nested deeper than max_depth fail with E_DEPTH instead of exhausting the stack
+    error_code_t try_skip(const size_t max_depth = validated_buffer::default_max_depth) {
+        const iterator it = _it;
+        return restore(it, skip_value(max_depth));
+    }
+
+    // An unpacker over a view taken from this one, e.g. by extracting a buffer_view. Unlike
+    // a sub-unpacker it holds no reference to the buffer, no atomic reference count is
+    // touched, and it must not outlive the buffer. Unchecked unpackers borrow views of
+    // their validated buffer.
+    basic_unpacker borrow(const buffer_view v) const {
+        basic_unpacker u;
+        u._it = v.data;
+        u._it_end = v.data + v.size;
+        return u;
+    }
+
     bool empty() const { return _it == _it_end; }
-    inline const data_type_t type() const;
-    inline unpacker& skip();
+    // the bytes not read yet
+    buffer_view view() const { return buffer_view{ _it, remaining() }; }
+    // the type of the next value, unchecked unpackers require !empty()
+    inline data_type_t type() const;
+    inline basic_unpacker& skip(size_t max_depth = validated_buffer::default_max_depth);
 
 private:
-    enum storage_type_t : uint8_t {
-        SFIXINT = 1,
-        SFIXARR = 2,
-        SFIXMAP = 3,
-        SFIXSTR = 4,
-        SNIL = 5,
-        SUNUSED = 0,
-        SFALSE = 6,
-        STRUE = 7,
-        SBIN8 = 8,
-        SBIN16 = 9,
-        SBIN32 = 10,
-        SEXT8 = 11,
-        SEXT16 = 12,
-        SEXT32 = 13,
-        SFLT32 = 14,
-        SFLT64 = 15,
-        SUINT8 = 16,
-        SUINT16 = 17,
-        SUINT32 = 18,
-        SUINT64 = 19,
-        SINT8 = 20,
-        SINT16 = 21,
-        SINT32 = 22,
-        SINT64 = 23,
-
-        SFEXT1 = 24,
-        SFEXT2 = 25,
-        SFEXT4 = 26,
-        SFEXT8 = 27,
-        SFEXT16 = 28,
-        SSTR8 = 29,
-        SSTR16 = 30,
-        SSTR32 = 31,
-        SARR16 = 32,
-        SARR32 = 33,
-        SMAP16 = 34,
-        SMAP32 = 35,
-        SFIXNINT = 36,
-    };
+    using iterator = const uint8_t*;
 
-    std::shared_ptr<buffer_type> _buffer;
-    buffer_type::const_iterator _it;
-    buffer_type::const_iterator _it_end;
+    // keeps the bytes alive, whatever allocated them
+    std::shared_ptr<const void> _buffer;
+    iterator _it = nullptr;
+    iterator _it_end = nullptr;
 
-    uint8_t peek_byte() const {
-        if (_it != _it_end) { return *_it; }
-        throw output_underflow_error{};
+    size_t remaining() const { return static_cast<size_t>(_it_end - _it); }
+
+    // a buffer and its shared state in a single allocation
+    template<typename ... _Args> void own(const allocator_type& allocator, _Args&& ... args) {
+        const std::shared_ptr<buffer_type> b = std::allocate_shared<buffer_type>(allocator, std::forward<_Args>(args)...);
+        _it = b->data();
+        _it_end = _it + b->size();
+        _buffer = b;
+    }
+
+    // the descriptor of the next value, the only table lookup made per value
+    error_code_t peek_type(const descriptor*& d) const {
+        if (Traits::checked && _it == _it_end) { return E_UNDERFLOW; }
+        d = &describe(*_it);
+        return E_OK;
     }
 
-    uint8_t get_byte() {
-        if (_it != _it_end) { return *_it++; }
-        throw output_underflow_error();
+    // reads the header of the next value, reporting it to the tracer
+    error_code_t decode_type(const descriptor*& d) const {
+        MSGPACK_TRY(peek_type(d));
+        tracer::on_decode(d->storage);
+        return E_OK;
     }
 
-    void skip_bytes(size_t count) {
-        if (_it + count > _it_end) { throw output_underflow_error(); }
+    error_code_t skip_bytes(size_t count) {
+        if (Traits::checked && count > remaining()) { return E_UNDERFLOW; }
         _it += count;
+        return E_OK;
     }
 
-    inline size_t get_string_length();
+    template<typename T> error_code_t get_numeric(T& value) {
+        if (Traits::checked && sizeof(T) > remaining()) { return E_UNDERFLOW; }
+        value = platform::load_be<T>(_it);
+        _it += sizeof(T);
+        return E_OK;
+    };
 
-    inline size_t get_array_length();
+    template<typename T, typename U> error_code_t get_numeric_as(T& value) {
+        U v;
+        MSGPACK_TRY(get_numeric(v));
+        value = static_cast<T>(v);
+        return E_OK;
+    }
 
-    inline size_t get_map_length();
+    // an integer of any form converted to floating point, as packed with compact_floats
+    template<typename T> error_code_t get_integer_as(T& value, const storage_type_t st) {
+        switch (st) {
+            case SFIXINT:
+            case SFIXNINT:
+                value = static_cast<T>(static_cast<int8_t>(*_it++));
+                return E_OK;
+            case SINT8:
+                ++_it;
+                return get_numeric_as<T, int8_t>(value);
+            case SINT16:
+                ++_it;
+                return get_numeric_as<T, int16_t>(value);
+            case SINT32:
+                ++_it;
+                return get_numeric_as<T, int32_t>(value);
+            case SINT64:
+                ++_it;
+                return get_numeric_as<T, int64_t>(value);
+            case SUINT8:
+                ++_it;
+                return get_numeric_as<T, uint8_t>(value);
+            case SUINT16:
+                ++_it;
+                return get_numeric_as<T, uint16_t>(value);
+            case SUINT32:
+                ++_it;
+                return get_numeric_as<T, uint32_t>(value);
+            case SUINT64:
+                ++_it;
+                return get_numeric_as<T, uint64_t>(value);
+            default:
+                return E_CONVERSION;
+        }
+    }
 
-    template<typename T> T get_numeric() {
-        union {
-            T data;
-            uint8_t bytes[sizeof(T)];
-        } cvt;
-        for (uint8_t& b : cvt.bytes) { b = get_byte(); }
-        return platform::ntoh(cvt.data);
-    };
+    error_code_t restore(const iterator it, const error_code_t e) {
+        if (e != E_OK) { _it = it; }
+        return e;
+    }
 
-    inline static const storage_type_t storage_type(uint8_t b);
-};
+    void check(const error_code_t e) const {
+        if (e != E_OK) { raise(e); }
+    }
 
-unpacker& unpacker::operator>>(bool& value) {
-    const storage_type_t st = storage_type(peek_byte());
-    if (st == STRUE) {
-        get_byte();
-        value = true;
-    } else if (st == SFALSE) {
-        get_byte();
-        value = false;
-    } else {
-        throw output_conversion_error{ peek_byte() };
+    [[noreturn]] inline void raise(error_code_t e) const;
+
+    inline error_code_t get(bool& value);
+    template<typename T> typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, error_code_t>::type
+    get(T& value);
+    template<typename T> typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value
+                                                 && !std::is_same<bool, T>::value, error_code_t>::type
+    get(T& value);
+    inline error_code_t get(float& value);
+    inline error_code_t get(double& value);
+    template<typename Allocator> error_code_t get(std::basic_string<char, std::char_traits<char>, Allocator>& value);
+    template<typename CharT, typename Allocator>
+    typename std::enable_if<!std::is_same<char, CharT>::value, error_code_t>::type
+    get(std::basic_string<CharT, std::char_traits<CharT>, Allocator>& value);
+    inline error_code_t get(basic_unpacker& value);
+    inline error_code_t get(buffer_view& value);
+    inline error_code_t get(timestamp& value);
+
+    template<typename Duration>
+    error_code_t get(std::chrono::time_point<std::chrono::system_clock, Duration>& value) {
+        timestamp ts;
+        MSGPACK_TRY(get(ts));
+        value = std::chrono::time_point<std::chrono::system_clock, Duration>{ ts.to<Duration>() };
+        return E_OK;
+    }
+
+    template<typename Rep, typename Period> error_code_t get(std::chrono::duration<Rep, Period>& value) {
+        timestamp ts;
+        MSGPACK_TRY(get(ts));
+        value = ts.to<std::chrono::duration<Rep, Period>>();
+        return E_OK;
+    }
+
+    template<typename T, typename Allocator> error_code_t get(std::vector<T, Allocator>& vec);
+    template<typename T, typename Allocator> error_code_t get_in_place(std::vector<T, Allocator>& vec, size_t first);
+    template<typename Allocator> error_code_t get_in_place(std::vector<bool, Allocator>& vec, size_t first);
+    template<typename K, typename V, typename Compare, typename Allocator>
+    error_code_t get(std::map<K, V, Compare, Allocator>& map);
+
+    // types decoded by a user provided operator>>, errors are reported by that operator
+    template<typename T> typename std::enable_if<!std::is_arithmetic<T>::value
+                                                 && !has_fields<T, basic_unpacker>::value, error_code_t>::type
+    get(T& value) {
+        *this >> value;
+        return E_OK;
+    }
+
+    template<typename T> typename std::enable_if<has_fields<T, basic_unpacker>::value, error_code_t>::type
+    get(T& value) {
+        return get_fields(value);
+    }
+
+    template<typename T> error_code_t get_fields(T& value);
+
+    // the shape of the maps last decoded into a T on this thread
+    template<typename T> static map_shape* shape_of(std::true_type) {
+        static thread_local map_shape shape;
+        return &shape;
+    }
+
+    template<typename T> static map_shape* shape_of(std::false_type) { return nullptr; }
+
+    // Reused structs start from their defaults so fields absent from the map do not keep the
+    // values of an earlier message. Copying a default instance keeps the capacity of strings
+    // and containers, types which cannot be copied are assigned a new instance.
+    template<typename T> static void reset_fields(T&, std::false_type) {}
+
+    template<typename T> static void reset_fields(T& value, std::true_type) {
+        assign_defaults(value, std::is_copy_assignable<T>{});
     }
 
+    template<typename T> static void assign_defaults(T& value, std::true_type) {
+        static const T defaults{};
+        value = defaults;
+    }
+
+    template<typename T> static void assign_defaults(T& value, std::false_type) { value = T{}; }
+
+    template<typename T, typename F> error_code_t get_array(F& f);
+    template<typename K, typename V, typename F> error_code_t get_map(F& f);
+
+    inline error_code_t get_length(const descriptor& d, size_t& len);
+    inline error_code_t get_header(data_type_t type, size_t& len);
+    inline error_code_t skip_value(size_t depth = validated_buffer::default_max_depth);
+
+    template<typename V> error_code_t visit_value(V& v, size_t depth);
+    template<typename V> error_code_t visit_bytes(V& v, storage_type_t st, size_t len);
+
+    template<typename T, typename V> error_code_t visit_int(V& v) {
+        T x;
+        ++_it;
+        MSGPACK_TRY(get_numeric(x));
+        v.on_int(x);
+        return E_OK;
+    }
+
+    template<typename T, typename V> error_code_t visit_uint(V& v) {
+        T x;
+        ++_it;
+        MSGPACK_TRY(get_numeric(x));
+        v.on_uint(x);
+        return E_OK;
+    }
+
+    template<typename T, typename V> error_code_t visit_float(V& v) {
+        T x;
+        ++_it;
+        MSGPACK_TRY(get_numeric(x));
+        v.on_double(x);
+        return E_OK;
+    }
+};
+
+template<typename Traits> void basic_unpacker<Traits>::raise(error_code_t e) const {
+#if MSGPACK_HAS_EXCEPTIONS
+    if (e == E_UNDERFLOW) { throw output_underflow_error{}; }
+    if (e == E_DEPTH) { throw output_conversion_error{ "nesting too deep" }; }
+    if (e == E_ENCODING) { throw output_conversion_error{ "invalid utf-8" }; }
+    if (empty()) { throw output_conversion_error{}; }
+    throw output_conversion_error{ *_it };
+#else
+    (void) e;
+    std::abort();
+#endif
+}
+
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(bool& value) {
+    check(get(value));
     return *this;
 }
 
-unpacker& unpacker::operator>>(int8_t& value) {
-    const storage_type_t st = storage_type(peek_byte());
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(int8_t& value) {
+    check(get(value));
+    return *this;
+}
 
-    if (st == SFIXINT || st == SFIXNINT) {
-        value = get_byte();
-    } else if (st == SINT8) {
-        get_byte();
-        value = get_byte();
-    } else {
-        throw output_conversion_error{ peek_byte() };
-    }
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(int16_t& value) {
+    check(get(value));
     return *this;
 }
 
-unpacker& unpacker::operator>>(int16_t& value) {
-    const storage_type_t st = storage_type(peek_byte());
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(int32_t& value) {
+    check(get(value));
+    return *this;
+}
 
-    if (type() == T_INT8) {
-        value = get_value<int8_t>();
-    } else if (st == SINT16) {
-        get_byte();
-        value = get_numeric<int16_t>();
-    } else {
-        throw output_conversion_error{ peek_byte() };
-    }
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(int64_t& value) {
+    check(get(value));
+    return *this;
+}
 
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(uint8_t& value) {
+    check(get(value));
     return *this;
 }
 
-unpacker& unpacker::operator>>(int32_t& value) {
-    const storage_type_t st = storage_type(peek_byte());
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(uint16_t& value) {
+    check(get(value));
+    return *this;
+}
 
-    if (type() == T_INT8) {
-        value = get_value<int8_t>();
-    } else if (st == SINT16) {
-        value = get_value<int16_t>();
-    } else if (st == SINT32) {
-        get_byte();
-        value = get_numeric<int32_t>();
-    } else {
-        throw output_conversion_error{ peek_byte() };
-    }
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(uint32_t& value) {
+    check(get(value));
+    return *this;
+}
 
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(uint64_t& value) {
+    check(get(value));
     return *this;
 }
 
-unpacker& unpacker::operator>>(int64_t& value) {
-    const storage_type_t st = storage_type(peek_byte());
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(float& value) {
+    check(get(value));
+    return *this;
+}
 
-    if (type() == T_INT8) {
-        value = get_value<int8_t>();
-    } else if (st == SINT16) {
-        value = get_value<int16_t>();
-    } else if (st == SINT32) {
-        value = get_value<int32_t>();
-    } else if (st == SINT64) {
-        get_byte();
-        value = get_numeric<int64_t>();
-    } else {
-        throw output_conversion_error{ peek_byte() };
-    }
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(double& value) {
+    check(get(value));
+    return *this;
+}
 
+template<typename Traits> template<typename CharT, typename Allocator> basic_unpacker<Traits>&
+basic_unpacker<Traits>::operator>>(std::basic_string<CharT, std::char_traits<CharT>, Allocator>& value) {
+    check(get(value));
     return *this;
 }
 
-unpacker& unpacker::operator>>(uint8_t& value) {
-    const storage_type_t st = storage_type(peek_byte());
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(basic_unpacker& value) {
+    check(get(value));
+    return *this;
+}
 
-    if (st == SFIXINT) {
-        value = get_byte();
-    } else if (st == SUINT8) {
-        get_byte();
-        value = get_byte();
-    } else {
-        throw output_conversion_error{ peek_byte() };
-    }
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(buffer_view& value) {
+    check(get(value));
     return *this;
 }
 
-unpacker& unpacker::operator>>(uint16_t& value) {
-    const storage_type_t st = storage_type(peek_byte());
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(timestamp& value) {
+    check(get(value));
+    return *this;
+}
 
-    if (type() == T_UINT8 || st == SFIXINT) {
-        value = get_value<uint8_t>();
-    } else if (st == SUINT16) {
-        get_byte();
-        value = get_numeric<uint16_t>();
-    } else {
-        throw output_conversion_error{ peek_byte() };
-    }
+template<typename Traits> template<typename T, typename F> basic_unpacker<Traits>& basic_unpacker<Traits>::for_each(F f) {
+    check(get_array<T>(f));
+    return *this;
+}
 
+template<typename Traits> template<typename T, typename Allocator>
+basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(std::vector<T, Allocator>& vec) {
+    check(get(vec));
     return *this;
 }
 
-unpacker& unpacker::operator>>(uint32_t& value) {
-    const storage_type_t st = storage_type(peek_byte());
+template<typename Traits> template<typename K, typename V, typename F> basic_unpacker<Traits>& basic_unpacker<Traits>::for_each(F f) {
+    check(get_map<K, V>(f));
+    return *this;
+}
 
-    if (type() == T_UINT8 || st == SFIXINT) {
-        value = get_value<uint8_t>();
-    } else if (st == SUINT16) {
-        value = get_value<uint16_t>();
-    } else if (st == SUINT32) {
-        get_byte();
-        value = get_numeric<uint32_t>();
-    } else {
-        throw output_conversion_error{ peek_byte() };
-    }
+template<typename Traits> template<typename K, typename V, typename Compare, typename Allocator>
+basic_unpacker<Traits>& basic_unpacker<Traits>::operator>>(std::map<K, V, Compare, Allocator>& map) {
+    check(get(map));
+    return *this;
+}
 
+template<typename Traits> basic_unpacker<Traits>& basic_unpacker<Traits>::skip(const size_t max_depth) {
+    check(skip_value(max_depth));
     return *this;
 }
 
-unpacker& unpacker::operator>>(uint64_t& value) {
-    const storage_type_t st = storage_type(peek_byte());
+template<typename Traits> types::data_type_t basic_unpacker<Traits>::type() const {
+    const descriptor* d;
+    check(peek_type(d));
+    return static_cast<data_type_t>(d->type);
+}
+
+template<typename Traits> error_code_t basic_unpacker<Traits>::get(bool& value) {
+    const descriptor* d;
+    MSGPACK_TRY(decode_type(d));
+    const storage_type_t st = d->storage;
 
-    if (type() == T_UINT8 || st == SFIXINT) {
-        value = get_value<uint8_t>();
-    } else if (st == SUINT16) {
-        value = get_value<uint16_t>();
-    } else if (st == SUINT32) {
-        value = get_value<uint32_t>();
-    } else if (st == SUINT64) {
-        get_byte();
-        value = get_numeric<uint64_t>();
+    if (st == STRUE) {
+        value = true;
+    } else if (st == SFALSE) {
+        value = false;
     } else {
-        throw output_conversion_error{ peek_byte() };
+        return E_CONVERSION;
     }
+    ++_it;
 
-    return *this;
+    return E_OK;
 }
 
-unpacker& unpacker::operator>>(float& value) {
-    const storage_type_t st = storage_type(peek_byte());
+// accepts every signed encoding which fits into T
+template<typename Traits> template<typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, error_code_t>::type
+basic_unpacker<Traits>::get(T& value) {
+    const descriptor* d;
+    MSGPACK_TRY(decode_type(d));
+    const storage_type_t st = d->storage;
 
-    if(st == SFLT32) {
-        get_byte();
-        value = get_numeric<float>();
-    } else {
-        throw output_conversion_error{ peek_byte() };
+    switch (st) {
+        case SFIXINT:
+        case SFIXNINT:
+            value = static_cast<int8_t>(*_it++);
+            return E_OK;
+
+        case SINT8:
+            ++_it;
+            return get_numeric_as<T, int8_t>(value);
+
+        case SINT16:
+            if (sizeof(T) < sizeof(int16_t)) { return E_CONVERSION; }
+            ++_it;
+            return get_numeric_as<T, int16_t>(value);
+
+        case SINT32:
+            if (sizeof(T) < sizeof(int32_t)) { return E_CONVERSION; }
+            ++_it;
+            return get_numeric_as<T, int32_t>(value);
+
+        case SINT64:
+            if (sizeof(T) < sizeof(int64_t)) { return E_CONVERSION; }
+            ++_it;
+            return get_numeric_as<T, int64_t>(value);
+
+        default:
+            return E_CONVERSION;
     }
-    return *this;
 }
 
-unpacker& unpacker::operator>>(double& value) {
-    const storage_type_t st = storage_type(peek_byte());
+// accepts every unsigned encoding which fits into T
+template<typename Traits> template<typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value
+                        && !std::is_same<bool, T>::value, error_code_t>::type
+basic_unpacker<Traits>::get(T& value) {
+    const descriptor* d;
+    MSGPACK_TRY(decode_type(d));
+    const storage_type_t st = d->storage;
 
-    if(type() == T_FLOAT) {
-        value = get_value<float>();
-    } else if(st == SFLT64) {
-        get_byte();
-        value = get_numeric<double>();
-    } else {
-        throw output_conversion_error{ peek_byte() };
+    switch (st) {
+        case SFIXINT:
+            value = *_it++;
+            return E_OK;
+
+        case SUINT8:
+            ++_it;
+            return get_numeric_as<T, uint8_t>(value);
+
+        case SUINT16:
+            if (sizeof(T) < sizeof(uint16_t)) { return E_CONVERSION; }
+            ++_it;
+            return get_numeric_as<T, uint16_t>(value);
+
+        case SUINT32:
+            if (sizeof(T) < sizeof(uint32_t)) { return E_CONVERSION; }
+            ++_it;
+            return get_numeric_as<T, uint32_t>(value);
+
+        case SUINT64:
+            if (sizeof(T) < sizeof(uint64_t)) { return E_CONVERSION; }
+            ++_it;
+            return get_numeric_as<T, uint64_t>(value);
+
+        default:
+            return E_CONVERSION;
     }
-    return *this;
 }
 
+template<typename Traits> error_code_t basic_unpacker<Traits>::get(float& value) {
+    const descriptor* d;
+    MSGPACK_TRY(decode_type(d));
+    const storage_type_t st = d->storage;
 
-unpacker& unpacker::operator>>(std::string& value) {
-    std::iterator_traits<decltype(_it)>::difference_type len = get_string_length();
+    if (st != SFLT32) { return get_integer_as(value, st); }
+    ++_it;
+    return get_numeric(value);
+}
 
-    if (len > distance(_it, _it_end)) {
-        throw output_underflow_error{};
+template<typename Traits> error_code_t basic_unpacker<Traits>::get(double& value) {
+    const descriptor* d;
+    MSGPACK_TRY(decode_type(d));
+    const storage_type_t st = d->storage;
+
+    if (st == SFLT32) {
+        ++_it;
+        return get_numeric_as<double, float>(value);
+    } else if (st == SFLT64) {
+        ++_it;
+        return get_numeric(value);
     }
+    return get_integer_as(value, st);
+}
+
+template<typename Traits> template<typename Allocator>
+error_code_t basic_unpacker<Traits>::get(std::basic_string<char, std::char_traits<char>, Allocator>& value) {
+    const descriptor* d;
+    MSGPACK_TRY(decode_type(d));
+
+    if (d->type != T_STRING) { return E_CONVERSION; }
+    size_t len;
+    MSGPACK_TRY(get_length(*d, len));
+    tracer::on_length(T_STRING, len);
+    if (Traits::checked && len > remaining()) { return E_UNDERFLOW; }
+    if (Traits::validate_utf8 && !utf8::validate(_it, len)) { return E_ENCODING; }
+
     value.clear();
+    MSGPACK_STATS_GROWTH(value);
     value.append(_it, _it + len);
     _it += len;
 
-    return *this;
+    return E_OK;
 }
 
-unpacker& unpacker::operator >>(std::wstring& value) {
-    std::string buf;
-    *this >> buf;
+template<typename Traits> template<typename CharT, typename Allocator>
+typename std::enable_if<!std::is_same<char, CharT>::value, error_code_t>::type
+basic_unpacker<Traits>::get(std::basic_string<CharT, std::char_traits<CharT>, Allocator>& value) {
+    const descriptor* d;
+    MSGPACK_TRY(decode_type(d));
 
-    std::wstring_convert<std::codecvt_utf8<wchar_t>> cvt;
-    value = cvt.from_bytes(buf);
+    if (d->type != T_STRING) { return E_CONVERSION; }
+    size_t len;
+    MSGPACK_TRY(get_length(*d, len));
+    tracer::on_length(T_STRING, len);
+    if (Traits::checked && len > remaining()) { return E_UNDERFLOW; }
 
-    return *this;
-}
+    MSGPACK_STATS_GROWTH(value);
+    if (!utf8::decode(_it, len, value)) { return E_ENCODING; }
+    _it += len;
 
+    return E_OK;
+}
 
-unpacker& unpacker::operator>>(unpacker& value) {
+template<typename Traits> error_code_t basic_unpacker<Traits>::get(basic_unpacker& value) {
+    const iterator begin = _it;
+    MSGPACK_TRY(skip_value());
     value._buffer = _buffer;
-    value._it = _it;
-    skip();
+    value._it = begin;
     value._it_end = _it;
-    return *this;
+    return E_OK;
+}
+
+template<typename Traits> error_code_t basic_unpacker<Traits>::get(buffer_view& value) {
+    const iterator begin = _it;
+    MSGPACK_TRY(skip_value());
+    value = buffer_view{ begin, static_cast<size_t>(_it - begin) };
+    return E_OK;
 }
 
-template<typename T, typename F> unpacker& unpacker::for_each(F f) {
-    if(type() != T_ARRAY) { throw output_conversion_error("type is not an array"); }
+// dispatches every entry by the hash of its raw key bytes, without materializing the key
+template<typename Traits> template<typename T> error_code_t basic_unpacker<Traits>::get_fields(T& value) {
+    typename tracer::timer timer{ L_MESSAGE };
+    size_t len;
+    MSGPACK_TRY(get_header(T_MAP, len));
+    reset_fields(value, std::integral_constant<bool, Traits::reuse_capacity>{});
 
-    const size_t len = get_array_length();
+    // A nested T may relearn the shape while this map is decoded, which only costs misses
+    // since every hit is compared bytewise and a key always resolves to the same member.
+    map_shape* const shape = shape_of<T>(std::integral_constant<bool, Traits::cache_shapes>{});
+    bool hit = shape != nullptr && shape->size() == len;
+    if (shape != nullptr && !hit) { shape->truncate(0); }
 
+    trace_scope<tracer> scope;
+    size_t field = 0;
     for (size_t i = 0; i < len; ++i) {
-        T val;
-        *this >> val;
-        f(val);
+        if (hit) {
+            if (shape->matches(i, _it, remaining())) {
+                // the member is known, no hash or key comparison
+                const map_shape::entry& e = (*shape)[i];
+                tracer::on_decode(e.storage);
+                tracer::on_length(T_STRING, e.size - e.header);
+                _it += e.size;
+                MSGPACK_TRY(value.decode_field(*this, e.field, nullptr, 0, field));
+                continue;
+            }
+            hit = false;
+            shape->truncate(i);
+        }
+
+        const iterator begin = _it;
+        const descriptor* d;
+        MSGPACK_TRY(decode_type(d));
+        if (d->type != T_STRING) { return E_CONVERSION; }
+        size_t key_len;
+        MSGPACK_TRY(get_length(*d, key_len));
+        tracer::on_length(T_STRING, key_len);
+        if (Traits::checked && key_len > remaining()) { return E_UNDERFLOW; }
+
+        const char* key = reinterpret_cast<const char*>(_it);
+        _it += key_len;
+        const size_t size = static_cast<size_t>(_it - begin);
+        MSGPACK_TRY(value.decode_field(*this, runtime_key_hash(key, key_len), key, key_len, field));
+        // unless a nested T has relearned the shape meanwhile
+        if (shape != nullptr && shape->size() == i) { shape->add(begin, size, size - key_len, d->storage, field); }
     }
 
-    return *this;
-}
-template<typename T> unpacker& unpacker::operator>>(std::vector<T>& vec) {
-    return for_each<T>([&vec](T v) {
-        vec.emplace_back(std::move(v));
-    });
+    return E_OK;
 }
 
-template<typename K, typename V, typename F> unpacker& unpacker::for_each(F f) {
-    if(type() != T_MAP) { throw output_conversion_error("type is not a map"); }
+// each form is read with a single fixed-width load, the 64-bit form is split by shift and mask
+template<typename Traits> error_code_t basic_unpacker<Traits>::get(timestamp& value) {
+    const descriptor* d;
+    MSGPACK_TRY(decode_type(d));
+    const storage_type_t st = d->storage;
+
+    const uint8_t ts_type = static_cast<uint8_t>(timestamp::ext_type);
+    timestamp ts;
+    size_t size;
+
+    switch (st) {
+        case SFEXT4:
+            size = 6;
+            if (Traits::checked && size > remaining()) { return E_UNDERFLOW; }
+            if (_it[1] != ts_type) { return E_CONVERSION; }
+            ts.seconds = platform::load_be<uint32_t>(_it + 2);
+            ts.nanoseconds = 0;
+            break;
 
-    const size_t len = get_map_length();
+        case SFEXT8: {
+            size = 10;
+            if (Traits::checked && size > remaining()) { return E_UNDERFLOW; }
+            if (_it[1] != ts_type) { return E_CONVERSION; }
+            const uint64_t v = platform::load_be<uint64_t>(_it + 2);
+            ts.seconds = static_cast<int64_t>(v & ((uint64_t{ 1 } << 34) - 1));
+            ts.nanoseconds = static_cast<uint32_t>(v >> 34);
+            break;
+        }
 
-    for (size_t i = 0; i < len; ++i) {
-        K key;
-        V value;
-        *this >> key;
-        *this >> value;
-        f(key, value);
+        case SEXT8:
+            size = 15;
+            if (Traits::checked && size > remaining()) { return E_UNDERFLOW; }
+            if (_it[1] != 12 || _it[2] != ts_type) { return E_CONVERSION; }
+            ts.nanoseconds = platform::load_be<uint32_t>(_it + 3);
+            ts.seconds = platform::load_be<int64_t>(_it + 7);
+            break;
+
+        default:
+            return E_CONVERSION;
     }
 
-    return *this;
+    if (ts.nanoseconds > timestamp::max_nanoseconds) { return E_CONVERSION; }
+    value = ts;
+    _it += size;
+    return E_OK;
 }
 
-template<typename K, typename V> unpacker& unpacker::operator>>(std::map<K, V>& map) {
-    return for_each<K, V>([&map](K k, V v){
-        map.emplace(std::make_pair(std::move(k), std::move(v)));
-    });
+// elements are decoded where they are stored, constructed by the allocator of vec
+template<typename Traits> template<typename T, typename Allocator>
+error_code_t basic_unpacker<Traits>::get(std::vector<T, Allocator>& vec) {
+    return get_in_place(vec, Traits::reuse_capacity ? 0 : vec.size());
 }
 
-const unpacker::data_type_t unpacker::type() const {
-    // @formatter:off
-        static const data_type_t map_table[] {
-                /*  0 */ T_UNKNOWN, T_INT8, T_ARRAY, T_MAP, T_STRING, T_NULL, T_BOOLEAN, T_BOOLEAN,
-                /*  8 */ T_BINARY, T_BINARY, T_BINARY, T_EXTERNAL, T_EXTERNAL, T_EXTERNAL, T_FLOAT, T_DOUBLE,
-                /* 16 */ T_UINT8, T_UINT16, T_UINT32, T_UINT64, T_INT8, T_INT16, T_INT32, T_INT64,
-                /* 24 */ T_EXTERNAL, T_EXTERNAL, T_EXTERNAL, T_EXTERNAL, T_EXTERNAL, T_STRING, T_STRING, T_STRING,
-                /* 32 */ T_ARRAY, T_ARRAY, T_MAP, T_MAP, T_INT8
-        };
-        // @formatter:on
+// overwrites the elements from first on, appends the others and drops the surplus
+template<typename Traits> template<typename T, typename Allocator>
+error_code_t basic_unpacker<Traits>::get_in_place(std::vector<T, Allocator>& vec, const size_t first) {
+    typename tracer::timer timer{ L_MESSAGE };
+    size_t len;
+    MSGPACK_TRY(get_header(T_ARRAY, len));
 
-    if (empty()) {
-        throw output_underflow_error();
-    } else {
-        return map_table[storage_type(peek_byte())];
+    trace_scope<tracer> scope;
+    for (size_t i = first; i < first + len; ++i) {
+        if (i == vec.size()) {
+            MSGPACK_STATS_GROWTH(vec);
+            vec.emplace_back();
+        }
+        MSGPACK_TRY(get(vec[i]));
     }
+    if (vec.size() > first + len) { vec.erase(vec.begin() + static_cast<std::ptrdiff_t>(first + len), vec.end()); }
+    return E_OK;
 }
 
-size_t unpacker::get_string_length() {
-    const storage_type_t st = storage_type(peek_byte());
+template<typename Traits> template<typename Allocator>
+error_code_t basic_unpacker<Traits>::get_in_place(std::vector<bool, Allocator>& vec, const size_t first) {
+    vec.resize(first);
+    auto f = [&vec](bool v) {
+        MSGPACK_STATS_GROWTH(vec);
+        vec.push_back(v);
+    };
+    return get_array<bool>(f);
+}
+
+// Keys and values are decoded into a pair constructed with the allocator of the map, so
+// allocator aware ones such as std::pmr strings allocate from its resource too, and then
+// moved into a node.
+template<typename Traits> template<typename K, typename V, typename Compare, typename Allocator>
+error_code_t basic_unpacker<Traits>::get(std::map<K, V, Compare, Allocator>& map) {
+    typename tracer::timer timer{ L_MESSAGE };
     size_t len;
+    MSGPACK_TRY(get_header(T_MAP, len));
+    // nodes cannot be reused, a map is only refilled
+    if (Traits::reuse_capacity) { map.clear(); }
 
-    if (st == SFIXSTR) {
-        len = get_byte() & 0x1fu;
-    } else if (st == SSTR8) {
-        get_byte();
-        len = get_byte();
-    } else if (st == SSTR16) {
-        get_byte();
-        len = get_numeric<uint16_t>();
-    } else if (st == SSTR32) {
-        get_byte();
-        len = get_numeric<uint32_t>();
-    } else {
-        throw output_conversion_error{ peek_byte() };
+    const Allocator allocator = map.get_allocator();
+    trace_scope<tracer> scope;
+    for (size_t i = 0; i < len; ++i) {
+        allocator_constructed<std::pair<K, V>, Allocator> entry{ allocator };
+        MSGPACK_TRY(get((*entry).first));
+        MSGPACK_TRY(get((*entry).second));
+        // one node per inserted element
+        MSGPACK_STATS_ALLOC(sizeof(typename std::map<K, V, Compare, Allocator>::value_type));
+        map.emplace(std::move(*entry));
     }
 
-    return len;
+    return E_OK;
 }
 
-size_t unpacker::get_array_length() {
-    const storage_type_t st = storage_type(peek_byte());
+template<typename Traits> template<typename T, typename F> error_code_t basic_unpacker<Traits>::get_array(F& f) {
+    typename tracer::timer timer{ L_MESSAGE };
+    size_t len;
+    MSGPACK_TRY(get_header(T_ARRAY, len));
 
-    if (st == SFIXARR) {
-        return get_byte() & 0xfu;
-    }
-    if (st == SARR16) {
-        get_byte();
-        return get_numeric<uint16_t>();
-    }
-    if (st == SARR32) {
-        get_byte();
-        return get_numeric<uint32_t>();
+    trace_scope<tracer> scope;
+    for (size_t i = 0; i < len; ++i) {
+        T val;
+        MSGPACK_TRY(get(val));
+        f(val);
     }
 
-    throw output_conversion_error{};
+    return E_OK;
 }
 
-size_t unpacker::get_map_length() {
-    const storage_type_t st = storage_type(peek_byte());
+template<typename Traits> template<typename K, typename V, typename F> error_code_t basic_unpacker<Traits>::get_map(F& f) {
+    typename tracer::timer timer{ L_MESSAGE };
+    size_t len;
+    MSGPACK_TRY(get_header(T_MAP, len));
 
-    if (st == SFIXMAP) {
-        return get_byte() & 0xfu;
-    }
-    if (st == SMAP16) {
-        get_byte();
-        return get_numeric<uint16_t>();
+    trace_scope<tracer> scope;
+    for (size_t i = 0; i < len; ++i) {
+        K key;
+        V value;
+        MSGPACK_TRY(get(key));
+        MSGPACK_TRY(get(value));
+        f(key, value);
     }
-    if (st == SMAP32) {
-        get_byte();
-        return get_numeric<uint32_t>();
+
+    return E_OK;
+}
+
+// advances past the header and length field of a string, bin, ext, array or map
+template<typename Traits> error_code_t basic_unpacker<Traits>::get_length(const descriptor& d, size_t& len) {
+    ++_it;
+    switch (d.length) {
+        case 0:
+            len = d.value;
+            return E_OK;
+        case 1:
+            return get_numeric_as<size_t, uint8_t>(len);
+        case 2:
+            return get_numeric_as<size_t, uint16_t>(len);
+        default:
+            return get_numeric_as<size_t, uint32_t>(len);
     }
+}
 
-    throw output_conversion_error{};
+template<typename Traits> error_code_t basic_unpacker<Traits>::get_header(const data_type_t type, size_t& len) {
+    const descriptor* d;
+    MSGPACK_TRY(decode_type(d));
+
+    if (d->type != type) { return E_CONVERSION; }
+    MSGPACK_TRY(get_length(*d, len));
+    tracer::on_length(type, len);
+    return E_OK;
 }
 
-unpacker& unpacker::skip() {
-    switch (storage_type(peek_byte())) {
+template<typename Traits> error_code_t basic_unpacker<Traits>::skip_value(const size_t depth) {
+    typename tracer::timer timer{ L_SKIP };
+    const descriptor* d;
+    MSGPACK_TRY(peek_type(d));
+
+    switch (d->type) {
+        case T_UNKNOWN:
+            return E_CONVERSION;
+
+        case T_STRING: {
+            size_t len;
+            MSGPACK_TRY(get_length(*d, len));
+            tracer::on_length(T_STRING, len);
+            return skip_bytes(len);
+        }
+
+        case T_ARRAY:
+        case T_MAP: {
+            if (depth == 0) { return E_DEPTH; }
+            size_t len;
+            MSGPACK_TRY(get_length(*d, len));
+            if (d->type == T_MAP) { len *= 2; }
+            trace_scope<tracer> scope;
+            for (size_t i = 0; i < len; ++i) {
+                MSGPACK_TRY(skip_value(depth - 1));
+            }
+            return E_OK;
+        }
+
+        default:
+            // scalars and fixed size extensions
+            if (d->length == 0) { return skip_bytes(size_t{ 1 } + d->payload); }
+
+            // bin and ext, extensions carry their type byte in front of the data
+            size_t len;
+            MSGPACK_TRY(get_length(*d, len));
+            return skip_bytes(d->payload + len);
+    }
+}
+
+template<typename Traits> template<typename V> error_code_t basic_unpacker<Traits>::visit_value(V& v, const size_t depth) {
+    const descriptor* d;
+    MSGPACK_TRY(decode_type(d));
+    const storage_type_t st = d->storage;
+
+    size_t len;
+    switch (st) {
+        case SNIL:
+            ++_it;
+            v.on_nil();
+            return E_OK;
+
         case STRUE:
         case SFALSE:
+            ++_it;
+            v.on_bool(st == STRUE);
+            return E_OK;
+
         case SFIXINT:
+            v.on_uint(*_it++);
+            return E_OK;
         case SFIXNINT:
-        case SNIL:
-            skip_bytes(1);
-            break;
+            v.on_int(static_cast<int8_t>(*_it++));
+            return E_OK;
 
         case SINT8:
-        case SUINT8:
-            skip_bytes(2);
-            break;
-
+            return visit_int<int8_t>(v);
         case SINT16:
-        case SUINT16:
-            skip_bytes(3);
-            break;
-
+            return visit_int<int16_t>(v);
         case SINT32:
-        case SUINT32:
-        case SFLT32:
-            skip_bytes(5);
-            break;
-
+            return visit_int<int32_t>(v);
         case SINT64:
+            return visit_int<int64_t>(v);
+        case SUINT8:
+            return visit_uint<uint8_t>(v);
+        case SUINT16:
+            return visit_uint<uint16_t>(v);
+        case SUINT32:
+            return visit_uint<uint32_t>(v);
         case SUINT64:
+            return visit_uint<uint64_t>(v);
+        case SFLT32:
+            return visit_float<float>(v);
         case SFLT64:
-            skip_bytes(9);
-            break;
+            return visit_float<double>(v);
 
         case SFIXSTR:
         case SSTR8:
         case SSTR16:
         case SSTR32:
-            skip_bytes(get_string_length());
-            break;
+            MSGPACK_TRY(get_length(*d, len));
+            tracer::on_length(T_STRING, len);
+            if (Traits::checked && len > remaining()) { return E_UNDERFLOW; }
+            if (Traits::validate_utf8 && !utf8::validate(_it, len)) { return E_ENCODING; }
+            v.on_str(reinterpret_cast<const char*>(_it), len);
+            _it += len;
+            return E_OK;
+
+        case SBIN8:
+        case SBIN16:
+        case SBIN32:
+        case SEXT8:
+        case SEXT16:
+        case SEXT32:
+            MSGPACK_TRY(get_length(*d, len));
+            return visit_bytes(v, st, len);
+
+        case SFEXT1:
+        case SFEXT2:
+        case SFEXT4:
+        case SFEXT8:
+        case SFEXT16:
+            ++_it;
+            return visit_bytes(v, st, d->payload - size_t{ 1 });
 
         case SFIXARR:
         case SARR16:
         case SARR32: {
-            const size_t len = get_array_length();
+            if (depth == 0) { return E_DEPTH; }
+            MSGPACK_TRY(get_length(*d, len));
+            tracer::on_length(T_ARRAY, len);
+            v.begin_array(len);
+            trace_scope<tracer> scope;
             for (size_t i = 0; i < len; ++i) {
-                skip();
+                MSGPACK_TRY(visit_value(v, depth - 1));
             }
+            v.end_array();
+            return E_OK;
         }
-            break;
 
         case SFIXMAP:
         case SMAP16:
         case SMAP32: {
-            const size_t len = get_map_length();
+            if (depth == 0) { return E_DEPTH; }
+            MSGPACK_TRY(get_length(*d, len));
+            tracer::on_length(T_MAP, len);
+            v.begin_map(len);
+            trace_scope<tracer> scope;
             for (size_t i = 0; i < len; ++i) {
-                skip();
-                skip();
+                MSGPACK_TRY(visit_value(v, depth - 1));
+                MSGPACK_TRY(visit_value(v, depth - 1));
             }
+            v.end_map();
+            return E_OK;
         }
-            break;
 
         default:
-            throw output_conversion_error{ peek_byte() };
+            return E_CONVERSION;
     }
-    return *this;
 }
 
+// payload of bin and ext values, the read position is past the header and length
+template<typename Traits> template<typename V>
+error_code_t basic_unpacker<Traits>::visit_bytes(V& v, const storage_type_t st, const size_t len) {
+    if (st == SBIN8 || st == SBIN16 || st == SBIN32) {
+        if (Traits::checked && len > remaining()) { return E_UNDERFLOW; }
+        tracer::on_length(T_BINARY, len);
+        v.on_bin(_it, len);
+        _it += len;
+        return E_OK;
+    }
 
-const unpacker::storage_type_t unpacker::storage_type(uint8_t b) {
-    // @formatter:off
-    static const storage_type_t map_table[128] = {
-            /* 0x80 */  SFIXMAP,  SFIXMAP,  SFIXMAP,  SFIXMAP,  SFIXMAP,  SFIXMAP,  SFIXMAP,  SFIXMAP,
-            /* 0x88 */  SFIXMAP,  SFIXMAP,  SFIXMAP,  SFIXMAP,  SFIXMAP,  SFIXMAP,  SFIXMAP,  SFIXMAP,
-            /* 0x90 */  SFIXARR,  SFIXARR,  SFIXARR,  SFIXARR,  SFIXARR,  SFIXARR,  SFIXARR,  SFIXARR,
-            /* 0x98 */  SFIXARR,  SFIXARR,  SFIXARR,  SFIXARR,  SFIXARR,  SFIXARR,  SFIXARR,  SFIXARR,
-            /* 0xa0 */  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,
-            /* 0xa8 */  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,
-            /* 0xb0 */  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,
-            /* 0xb8 */  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,  SFIXSTR,
-            /* 0xc0 */  SNIL,     SUNUSED,  SFALSE,   STRUE,    SBIN8,    SBIN16,   SBIN32,   SEXT8,
-            /* 0xc8 */  SEXT16,   SEXT32,   SFLT32,   SFLT64,   SUINT8,   SUINT16,  SUINT32,  SUINT64,
-            /* 0xd0 */  SINT8,    SINT16,   SINT32,   SINT64,   SFEXT1,   SFEXT2,   SFEXT4,   SFEXT8,
-            /* 0xd8 */  SFEXT16,  SSTR8,    SSTR16,   SSTR32,   SARR16,   SARR32,   SMAP16,   SMAP32,
-            /* 0xe0 */  SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT,
-            /* 0xe8 */  SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT,
-            /* 0xf0 */  SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT,
-            /* 0xf8 */  SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT, SFIXNINT
-    };
-    // @formatter:on
+    if (Traits::checked && len >= remaining()) { return E_UNDERFLOW; }
+    v.on_ext(static_cast<int8_t>(*_it), _it + 1, len);
+    _it += len + 1;
+    return E_OK;
+}
+
+error_code_t validated_buffer::validate_value(const uint8_t*& it, const uint8_t* end, size_t depth) {
+    if (it == end) { return E_UNDERFLOW; }
+
+    const types::descriptor& d = types::describe(*it++);
+    size_t len = d.value;
+
+    switch (d.length) {
+        case 1:
+            MSGPACK_TRY(validate_length<uint8_t>(it, end, len));
+            break;
+        case 2:
+            MSGPACK_TRY(validate_length<uint16_t>(it, end, len));
+            break;
+        case 4:
+            MSGPACK_TRY(validate_length<uint32_t>(it, end, len));
+            break;
+        default:
+            break;
+    }
+
+    switch (d.type) {
+        case types::T_UNKNOWN:
+            return E_CONVERSION;
 
-    return static_cast<const storage_type_t>((b <= 0x7f) ? SFIXINT : map_table[b - 0x80]);
+        case types::T_ARRAY:
+        case types::T_MAP:
+            break;
+
+        case types::T_STRING:
+            return validate_bytes(it, end, len);
+
+        default:
+            // bin and ext are followed by their length, scalars only by their payload
+            return validate_bytes(it, end, d.payload + (d.length != 0 ? len : 0));
+    }
+
+    // containers
+    if (depth == 0) { return E_DEPTH; }
+    if (d.type == types::T_MAP) { len *= 2; }
+    // every value takes at least one byte
+    if (len > static_cast<size_t>(end - it)) { return E_UNDERFLOW; }
+    for (size_t i = 0; i < len; ++i) {
+        MSGPACK_TRY(validate_value(it, end, depth - 1));
+    }
+    return E_OK;
 }
 
-inline std::string to_string(const unpacker& value, size_t level = 0) {
-    unpacker u { value };
+using unpacker = basic_unpacker<>;
+using unchecked_unpacker = basic_unpacker<unchecked_unpacker_traits>;
+
+#if MSGPACK_HAS_PMR
+using pmr_unpacker = basic_unpacker<allocator_unpacker_traits<std::pmr::polymorphic_allocator<uint8_t>>>;
+#endif
+
+// nested values are borrowed views, the reference count of the buffer is not touched
+template<typename Traits> std::string to_string(const basic_unpacker<Traits>& value, size_t level = 0) {
+    basic_unpacker<Traits> u = value.borrow(value.view());
     std::string ret;
 
     if(level == 0) {
@@ -604,55 +1388,56 @@ inline std::string to_string(const unpacker& value, size_t level = 0) {
     }
 
     while (!u.empty()) {
+        MSGPACK_STATS_GROWTH(ret);
         switch (u.type()) {
-            case unpacker::T_BOOLEAN:
-                ret += u.get_value<bool>() ? "true" : "false";
+            case types::T_BOOLEAN:
+                ret += u.template get_value<bool>() ? "true" : "false";
                 break;
-            case unpacker::T_INT8:
-                ret += std::to_string(u.get_value<int8_t>());
+            case types::T_INT8:
+                ret += std::to_string(u.template get_value<int8_t>());
                 break;
-            case unpacker::T_INT16:
-                ret += std::to_string(u.get_value<int16_t>());
+            case types::T_INT16:
+                ret += std::to_string(u.template get_value<int16_t>());
                 break;
-            case unpacker::T_INT32:
-                ret += std::to_string(u.get_value<int32_t>());
+            case types::T_INT32:
+                ret += std::to_string(u.template get_value<int32_t>());
                 break;
-            case unpacker::T_INT64:
-                ret += std::to_string(u.get_value<int64_t>());
+            case types::T_INT64:
+                ret += std::to_string(u.template get_value<int64_t>());
                 break;
 
-            case unpacker::T_UINT8:
-                ret += std::to_string(u.get_value<uint8_t>());
+            case types::T_UINT8:
+                ret += std::to_string(u.template get_value<uint8_t>());
                 break;
-            case unpacker::T_UINT16:
-                ret += std::to_string(u.get_value<uint16_t>());
+            case types::T_UINT16:
+                ret += std::to_string(u.template get_value<uint16_t>());
                 break;
-            case unpacker::T_UINT32:
-                ret += std::to_string(u.get_value<uint32_t>());
+            case types::T_UINT32:
+                ret += std::to_string(u.template get_value<uint32_t>());
                 break;
-            case unpacker::T_UINT64:
-                ret += std::to_string(u.get_value<uint64_t>());
+            case types::T_UINT64:
+                ret += std::to_string(u.template get_value<uint64_t>());
                 break;
 
-            case unpacker::T_FLOAT:
-                ret += std::to_string(u.get_value<float>());
+            case types::T_FLOAT:
+                ret += std::to_string(u.template get_value<float>());
                 break;
-            case unpacker::T_DOUBLE:
-                ret += std::to_string(u.get_value<double>());
+            case types::T_DOUBLE:
+                ret += std::to_string(u.template get_value<double>());
                 break;
 
-            case unpacker::T_STRING:
-                ret += '"' + u.get_value<std::string>() + '"';
+            case types::T_STRING:
+                ret += '"' + u.template get_value<std::string>() + '"';
                 break;
 
-            case unpacker::T_ARRAY: {
-                std::vector<unpacker> v;
+            case types::T_ARRAY: {
+                std::vector<buffer_view> v;
 
                 u >> v;
                 ret += '[';
 
                 for(const auto& e: v) {
-                    ret += to_string(e, level + 1) + ',';
+                    ret += to_string(u.borrow(e), level + 1) + ',';
                 }
 
                 if(v.empty()) {
@@ -663,14 +1448,14 @@ inline std::string to_string(const unpacker& value, size_t level = 0) {
             }
                 break;
 
-            case unpacker::T_MAP: {
-                std::map<std::string, unpacker> m;
+            case types::T_MAP: {
+                std::map<std::string, buffer_view> m;
 
                 u >> m;
                 ret += '{';
 
                 for (const auto& e: m) {
-                    ret += '"' + e.first + '"' + ':' + to_string(e.second, level + 1) + ',';
+                    ret += '"' + e.first + '"' + ':' + to_string(u.borrow(e.second), level + 1) + ',';
                 }
 
                 if(m.empty()) {
@@ -681,13 +1466,17 @@ inline std::string to_string(const unpacker& value, size_t level = 0) {
             }
                 break;
 
-            case unpacker::T_NULL:
+            case types::T_NULL:
                 ret += "null";
                 u >> skip;
                 break;
 
             default:
+#if MSGPACK_HAS_EXCEPTIONS
                 throw output_conversion_error{};
+#else
+                std::abort();
+#endif
         }
         ret += ',';
     }
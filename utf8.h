@@ -0,0 +1,270 @@
+#ifndef MSGPACK_UTF8_H
+#define MSGPACK_UTF8_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include "platform.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define MSGPACK_UTF8_SSE2 1
+#   include <emmintrin.h>
+#else
+#   define MSGPACK_UTF8_SSE2 0
+#endif
+
+//*****************************************************************************
+// UTF-8 validation and transcoding from and to UTF-16 / UTF-32. ASCII runs
+// are processed 16 bytes at a time with SSE2 when available, multi byte
+// sequences are checked according to RFC 3629 (no overlong forms, no
+// surrogates, nothing above U+10FFFF).
+//*****************************************************************************
+
+namespace msgpack {
+namespace utf8 {
+
+constexpr char32_t replacement_character = 0xfffd;
+
+// number of leading ASCII bytes
+inline size_t ascii_prefix(const uint8_t* p, const size_t n) {
+    size_t i = 0;
+#if MSGPACK_UTF8_SSE2
+    for (; i + 16 <= n; i += 16) {
+        const int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)));
+        if (mask != 0) { return i + platform::trailing_zeros(static_cast<uint32_t>(mask)); }
+    }
+#endif
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, sizeof(w));
+        if ((w & 0x8080808080808080u) != 0) { break; }
+    }
+    while (i < n && p[i] < 0x80) { ++i; }
+    return i;
+}
+
+// decodes the multi byte sequence starting at p, returns its length or 0 if it is invalid
+inline size_t decode_sequence(const uint8_t* p, const size_t n, char32_t& cp) {
+    const uint8_t b0 = p[0];
+
+    if (b0 < 0xc2) { return 0; }
+    if (b0 < 0xe0) {
+        if (n < 2 || (p[1] & 0xc0u) != 0x80) { return 0; }
+        cp = (char32_t{ b0 } & 0x1fu) << 6 | (p[1] & 0x3fu);
+        return 2;
+    }
+    if (b0 < 0xf0) {
+        if (n < 3 || (p[1] & 0xc0u) != 0x80 || (p[2] & 0xc0u) != 0x80) { return 0; }
+        if (b0 == 0xe0 && p[1] < 0xa0) { return 0; }
+        if (b0 == 0xed && p[1] >= 0xa0) { return 0; }
+        cp = (char32_t{ b0 } & 0x0fu) << 12 | (char32_t{ p[1] } & 0x3fu) << 6 | (p[2] & 0x3fu);
+        return 3;
+    }
+    if (b0 < 0xf5) {
+        if (n < 4 || (p[1] & 0xc0u) != 0x80 || (p[2] & 0xc0u) != 0x80 || (p[3] & 0xc0u) != 0x80) { return 0; }
+        if (b0 == 0xf0 && p[1] < 0x90) { return 0; }
+        if (b0 == 0xf4 && p[1] >= 0x90) { return 0; }
+        cp = (char32_t{ b0 } & 0x07u) << 18 | (char32_t{ p[1] } & 0x3fu) << 12 | (char32_t{ p[2] } & 0x3fu) << 6
+             | (p[3] & 0x3fu);
+        return 4;
+    }
+    return 0;
+}
+
+inline bool validate(const uint8_t* p, const size_t n) {
+    size_t i = 0;
+    while (true) {
+        i += ascii_prefix(p + i, n - i);
+        if (i == n) { return true; }
+
+        char32_t cp;
+        const size_t len = decode_sequence(p + i, n - i, cp);
+        if (len == 0) { return false; }
+        i += len;
+    }
+}
+
+inline bool validate(const char* p, const size_t n) {
+    return validate(reinterpret_cast<const uint8_t*>(p), n);
+}
+
+template<typename CharT> CharT* put_code_point(CharT* out, const char32_t cp) {
+    if (sizeof(CharT) == 2 && cp >= 0x10000) {
+        *out++ = static_cast<CharT>(0xd800u + ((cp - 0x10000u) >> 10));
+        *out++ = static_cast<CharT>(0xdc00u + ((cp - 0x10000u) & 0x3ffu));
+    } else {
+        *out++ = static_cast<CharT>(cp);
+    }
+    return out;
+}
+
+// widens 16 ASCII bytes
+template<typename CharT> void widen_ascii(const uint8_t* p, CharT* out) {
+#if MSGPACK_UTF8_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i lo = _mm_unpacklo_epi8(v, zero);
+    const __m128i hi = _mm_unpackhi_epi8(v, zero);
+    if (sizeof(CharT) == 2) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), hi);
+    } else {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm_unpackhi_epi16(hi, zero));
+    }
+#else
+    for (size_t i = 0; i < 16; ++i) { out[i] = p[i]; }
+#endif
+}
+
+// UTF-8 to UTF-16 (2 byte CharT) or UTF-32 (4 byte CharT), false if the input is not valid UTF-8
+template<typename CharT, typename Allocator>
+bool decode(const uint8_t* p, const size_t n, std::basic_string<CharT, std::char_traits<CharT>, Allocator>& out) {
+    static_assert(sizeof(CharT) == 2 || sizeof(CharT) == 4, "UTF-16 or UTF-32 code units expected");
+
+    // never more code units than bytes
+    out.resize(n);
+    CharT* const begin = &out[0];
+    CharT* o = begin;
+    size_t i = 0;
+
+    while (i < n) {
+        size_t ascii = n - i;
+#if MSGPACK_UTF8_SSE2
+        if (ascii >= 16) {
+            const int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)));
+            if (mask == 0) {
+                widen_ascii(p + i, o);
+                i += 16;
+                o += 16;
+                continue;
+            }
+            ascii = platform::trailing_zeros(static_cast<uint32_t>(mask));
+        }
+#endif
+        for (; ascii != 0 && p[i] < 0x80; --ascii) { *o++ = p[i++]; }
+        if (i == n) { break; }
+        if (p[i] < 0x80) { continue; }
+
+        char32_t cp;
+        const size_t len = decode_sequence(p + i, n - i, cp);
+        if (len == 0) {
+            out.clear();
+            return false;
+        }
+        i += len;
+        o = put_code_point(o, cp);
+    }
+
+    out.resize(static_cast<size_t>(o - begin));
+    return true;
+}
+
+// next code point of UTF-16 or UTF-32 input, invalid code units decode to the replacement character
+template<typename CharT> char32_t next_code_point(const CharT* p, const size_t n, size_t& i) {
+    const char32_t c = static_cast<char32_t>(p[i++]);
+
+    if (sizeof(CharT) == 2) {
+        if (c >= 0xd800 && c < 0xdc00 && i < n) {
+            const char32_t c2 = static_cast<char32_t>(p[i]);
+            if (c2 >= 0xdc00 && c2 < 0xe000) {
+                ++i;
+                return 0x10000u + ((c - 0xd800u) << 10) + (c2 - 0xdc00u);
+            }
+        }
+        return (c >= 0xd800 && c < 0xe000) ? replacement_character : c;
+    }
+    return (c > 0x10ffff || (c >= 0xd800 && c < 0xe000)) ? replacement_character : c;
+}
+
+inline size_t code_point_length(const char32_t cp) {
+    return cp < 0x80 ? 1 : (cp < 0x800 ? 2 : (cp < 0x10000 ? 3 : 4));
+}
+
+template<typename CharT> size_t encoded_length(const CharT* p, const size_t n) {
+    size_t len = 0;
+    for (size_t i = 0; i < n;) {
+        if (static_cast<char32_t>(p[i]) < 0x80) {
+            ++len;
+            ++i;
+        } else {
+            len += code_point_length(next_code_point(p, n, i));
+        }
+    }
+    return len;
+}
+
+// narrows 16 code units to bytes if all of them are ASCII
+template<typename CharT> bool narrow_ascii(const CharT* p, uint8_t* out) {
+#if MSGPACK_UTF8_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    if (sizeof(CharT) == 2) {
+        const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8));
+        const __m128i high = _mm_and_si128(_mm_or_si128(v0, v1), _mm_set1_epi16(static_cast<short>(0xff80)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(high, zero)) != 0xffff) { return false; }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(v0, v1));
+    } else {
+        const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 4));
+        const __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8));
+        const __m128i v3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12));
+        const __m128i all = _mm_or_si128(_mm_or_si128(v0, v1), _mm_or_si128(v2, v3));
+        const __m128i high = _mm_and_si128(all, _mm_set1_epi32(static_cast<int>(0xffffff80)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(high, zero)) != 0xffff) { return false; }
+        const __m128i w0 = _mm_packs_epi32(v0, v1);
+        const __m128i w1 = _mm_packs_epi32(v2, v3);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(w0, w1));
+    }
+    return true;
+#else
+    for (size_t i = 0; i < 16; ++i) {
+        if (static_cast<char32_t>(p[i]) >= 0x80) { return false; }
+    }
+    for (size_t i = 0; i < 16; ++i) { out[i] = static_cast<uint8_t>(p[i]); }
+    return true;
+#endif
+}
+
+// UTF-16 or UTF-32 to UTF-8, out must hold encoded_length(p, n) bytes
+template<typename CharT> uint8_t* encode(const CharT* p, const size_t n, uint8_t* out) {
+    static_assert(sizeof(CharT) == 2 || sizeof(CharT) == 4, "UTF-16 or UTF-32 code units expected");
+
+    for (size_t i = 0; i < n;) {
+        if (n - i >= 16 && narrow_ascii(p + i, out)) {
+            i += 16;
+            out += 16;
+            continue;
+        }
+
+        // at least one non ASCII unit, the next block is encoded one code point at a time
+        for (const size_t stop = std::min(n, i + 16); i < stop;) {
+            const char32_t cp = next_code_point(p, n, i);
+            if (cp < 0x80) {
+                *out++ = static_cast<uint8_t>(cp);
+            } else if (cp < 0x800) {
+                *out++ = static_cast<uint8_t>(0xc0u | (cp >> 6));
+                *out++ = static_cast<uint8_t>(0x80u | (cp & 0x3fu));
+            } else if (cp < 0x10000) {
+                *out++ = static_cast<uint8_t>(0xe0u | (cp >> 12));
+                *out++ = static_cast<uint8_t>(0x80u | ((cp >> 6) & 0x3fu));
+                *out++ = static_cast<uint8_t>(0x80u | (cp & 0x3fu));
+            } else {
+                *out++ = static_cast<uint8_t>(0xf0u | (cp >> 18));
+                *out++ = static_cast<uint8_t>(0x80u | ((cp >> 12) & 0x3fu));
+                *out++ = static_cast<uint8_t>(0x80u | ((cp >> 6) & 0x3fu));
+                *out++ = static_cast<uint8_t>(0x80u | (cp & 0x3fu));
+            }
+        }
+    }
+    return out;
+}
+
+}
+}
+
+#endif //MSGPACK_UTF8_H